@@ -0,0 +1,42 @@
+#include "concurrent_request_queue.h"
+
+using namespace std;
+
+ConcurrentRequestQueue::ConcurrentRequestQueue(const SearchServer& search_server)
+    : search_server_(search_server) {
+    for (auto& slot : slots_) {
+        slot.store(EncodeSlot(0, false), memory_order_relaxed);
+    }
+}
+
+vector<Document> ConcurrentRequestQueue::AddFindRequest(const string& raw_query, DocumentStatus status) {
+    return AddFindRequest(raw_query, [status](int, DocumentStatus document_status, int) {
+        return document_status == status;
+        });
+}
+
+vector<Document> ConcurrentRequestQueue::AddFindRequest(const string& raw_query) {
+    return AddFindRequest(raw_query, DocumentStatus::ACTUAL);
+}
+
+int ConcurrentRequestQueue::GetNoResultRequests() const {
+    return count_empty_requests_.load(memory_order_acquire);
+}
+
+void ConcurrentRequestQueue::RecordRequest(bool empty_request) {
+    const uint64_t timestamp = current_time_.fetch_add(1, memory_order_relaxed) + 1;
+    auto& slot = slots_[SlotIndex(timestamp)];
+    const uint64_t desired = EncodeSlot(timestamp, empty_request);
+    uint64_t expected = slot.load(memory_order_relaxed);
+    // A slower thread must not overwrite a newer request: if the slot already moved
+    // past our timestamp, this request has left the window before being recorded.
+    while ((expected >> 1) < timestamp) {
+        if (slot.compare_exchange_weak(expected, desired, memory_order_acq_rel, memory_order_relaxed)) {
+            const int delta = (empty_request ? 1 : 0) - static_cast<int>(expected & 1);
+            if (delta != 0) {
+                count_empty_requests_.fetch_add(delta, memory_order_acq_rel);
+            }
+            return;
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "search_server.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Thread-safe counterpart of RequestQueue. Searches run without any lock; recording
+// a request takes one ticket from a global counter and one CAS on its ring slot.
+// Every slot holds the newest request that maps to it, so once all requests have
+// been recorded the slots contain exactly the last min_in_day_ requests and
+// GetNoResultRequests() matches RequestQueue. While requests are still being
+// recorded it may lag by the ones in flight.
+class ConcurrentRequestQueue {
+public:
+    explicit ConcurrentRequestQueue(const SearchServer& search_server);
+
+    template <typename DocumentPredicate>
+    std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate);
+
+    std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentStatus status);
+
+    std::vector<Document> AddFindRequest(const std::string& raw_query);
+
+    int GetNoResultRequests() const;
+
+private:
+    // A slot packs the request timestamp with its "no result" flag in the low bit.
+    static uint64_t EncodeSlot(uint64_t timestamp, bool empty_request) {
+        return (timestamp << 1) | (empty_request ? 1 : 0);
+    }
+
+    // Consecutive tickets are spread over different cache lines, so threads recording
+    // at the same moment do not write the same line.
+    static size_t SlotIndex(uint64_t timestamp) {
+        const size_t position = timestamp % min_in_day_;
+        return position % SLOT_LINES * SLOTS_PER_LINE + position / SLOT_LINES;
+    }
+
+    void RecordRequest(bool empty_request);
+
+    const static int min_in_day_ = 1440;
+    static constexpr size_t SLOTS_PER_LINE = 64 / sizeof(std::atomic<uint64_t>);
+    static constexpr size_t SLOT_LINES = min_in_day_ / SLOTS_PER_LINE;
+    static_assert(min_in_day_ % SLOTS_PER_LINE == 0);
+
+    const SearchServer& search_server_;
+    alignas(64) std::array<std::atomic<uint64_t>, min_in_day_> slots_;
+    alignas(64) std::atomic<uint64_t> current_time_{ 0 };
+    alignas(64) std::atomic<int> count_empty_requests_{ 0 };
+};
+
+template <typename DocumentPredicate>
+std::vector<Document> ConcurrentRequestQueue::AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate) {
+    std::vector<Document> request = search_server_.FindTopDocuments(raw_query, document_predicate);
+    RecordRequest(request.empty());
+    return request;
+}
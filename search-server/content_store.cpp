@@ -0,0 +1,267 @@
+#include "content_store.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+// Compressed format: a sequence of (literal count, literals, match length - MIN_MATCH,
+// 2-byte match offset) ending with a final literal run. Counts are varints.
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t MAX_OFFSET = 65535;
+constexpr int HASH_BITS = 14;
+
+uint32_t Read32(const char* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+size_t Hash(uint32_t value) {
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+void PutVarint(string& out, size_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+[[noreturn]] void ThrowCorrupt() {
+    throw runtime_error("Corrupt content block"s);
+}
+
+size_t GetVarint(string_view in, size_t& pos) {
+    size_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (pos >= in.size()) {
+            ThrowCorrupt();
+        }
+        const uint8_t byte = static_cast<uint8_t>(in[pos++]);
+        value |= static_cast<size_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+    ThrowCorrupt();
+}
+
+string Compress(string_view input) {
+    string out;
+    out.reserve(input.size() / 2 + 16);
+    vector<int> last_seen(size_t{ 1 } << HASH_BITS, -1);
+    size_t literal_start = 0;
+    size_t pos = 0;
+    while (pos + MIN_MATCH <= input.size()) {
+        const uint32_t word = Read32(input.data() + pos);
+        int& slot = last_seen[Hash(word)];
+        const int candidate = slot;
+        slot = static_cast<int>(pos);
+        if (candidate < 0 || pos - candidate > MAX_OFFSET || Read32(input.data() + candidate) != word) {
+            ++pos;
+            continue;
+        }
+        size_t length = MIN_MATCH;
+        while (pos + length < input.size() && input[candidate + length] == input[pos + length]) {
+            ++length;
+        }
+        PutVarint(out, pos - literal_start);
+        out.append(input.substr(literal_start, pos - literal_start));
+        PutVarint(out, length - MIN_MATCH);
+        const size_t offset = pos - candidate;
+        out.push_back(static_cast<char>(offset & 0xFF));
+        out.push_back(static_cast<char>(offset >> 8));
+        pos += length;
+        literal_start = pos;
+    }
+    PutVarint(out, input.size() - literal_start);
+    out.append(input.substr(literal_start));
+    return out;
+}
+
+void Decompress(string_view in, size_t size, pmr::string& out) {
+    out.resize(size);
+    char* const data = out.data();
+    size_t written = 0;
+    size_t pos = 0;
+    while (true) {
+        const size_t literal_count = GetVarint(in, pos);
+        if (literal_count > in.size() - pos || literal_count > size - written) {
+            ThrowCorrupt();
+        }
+        memcpy(data + written, in.data() + pos, literal_count);
+        written += literal_count;
+        pos += literal_count;
+        if (pos == in.size()) {
+            break;
+        }
+        const size_t length = GetVarint(in, pos) + MIN_MATCH;
+        if (in.size() - pos < 2) {
+            ThrowCorrupt();
+        }
+        const size_t offset = static_cast<uint8_t>(in[pos]) | (static_cast<size_t>(static_cast<uint8_t>(in[pos + 1])) << 8);
+        pos += 2;
+        if (offset == 0 || offset > written || length > size - written) {
+            ThrowCorrupt();
+        }
+        const char* from = data + written - offset;
+        if (offset >= length) {
+            memcpy(data + written, from, length);
+        }
+        else {
+            // The match overlaps the bytes it produces, e.g. a run of one character.
+            for (size_t i = 0; i < length; ++i) {
+                data[written + i] = from[i];
+            }
+        }
+        written += length;
+    }
+    if (written != size) {
+        ThrowCorrupt();
+    }
+}
+
+} // namespace
+
+ContentStore::ContentStore(pmr::memory_resource* resource)
+    : locations_(resource)
+    , blocks_(resource)
+    , pending_(resource)
+    , cache_(resource)
+    , cache_index_(resource) {
+}
+
+ContentStore::~ContentStore() {
+    if (file_) {
+        fclose(file_);
+    }
+}
+
+void ContentStore::Append(string_view content) {
+    lock_guard guard(mutex_);
+    locations_.push_back({ static_cast<uint32_t>(blocks_.size()), static_cast<uint32_t>(pending_.size()), static_cast<uint32_t>(content.size()) });
+    pending_.append(content);
+    if (pending_.size() >= BLOCK_SIZE) {
+        FlushPendingBlock();
+    }
+}
+
+string ContentStore::Get(size_t index) const {
+    unique_lock lock(mutex_);
+    const Location location = locations_.at(index);
+    if (location.block == blocks_.size()) {
+        return string(string_view(pending_).substr(location.offset, location.size));
+    }
+    if (const auto it = cache_index_.find(location.block); it != cache_index_.end()) {
+        cache_.splice(cache_.begin(), cache_, it->second);
+        return string(string_view(it->second->second).substr(location.offset, location.size));
+    }
+    const Block info = blocks_[location.block];
+    lock.unlock();
+
+    // Written blocks never change, so the read and the decompression need no lock;
+    // two readers missing on the same block both load it and the second one is dropped.
+    pmr::string contents(cache_.get_allocator().resource());
+    LoadBlock(info, contents);
+    string text(string_view(contents).substr(location.offset, location.size));
+
+    lock.lock();
+    if (cache_capacity_ > 0 && cache_index_.count(location.block) == 0) {
+        if (cache_.size() >= cache_capacity_) {
+            cache_index_.erase(cache_.back().first);
+            cache_.pop_back();
+        }
+        cache_.emplace_front(location.block, move(contents));
+        cache_index_[location.block] = cache_.begin();
+    }
+    return text;
+}
+
+void ContentStore::Erase(size_t first, const vector<char>& keep) {
+    lock_guard guard(mutex_);
+    size_t kept = first;
+    for (size_t index = first; index < locations_.size(); ++index) {
+        if (index - first >= keep.size() || keep[index - first]) {
+            locations_[kept++] = locations_[index];
+        }
+    }
+    locations_.resize(kept);
+}
+
+void ContentStore::SetCacheCapacity(size_t blocks) {
+    lock_guard guard(mutex_);
+    cache_capacity_ = blocks;
+    while (cache_.size() > cache_capacity_) {
+        cache_index_.erase(cache_.back().first);
+        cache_.pop_back();
+    }
+}
+
+size_t ContentStore::GetReleasableBytes() const {
+    lock_guard guard(mutex_);
+    size_t bytes = pending_.capacity();
+    for (const auto& [block, text] : cache_) {
+        bytes += text.capacity();
+    }
+    return bytes;
+}
+
+size_t ContentStore::ReleaseMemory() {
+    lock_guard guard(mutex_);
+    size_t released = cache_.size();
+    cache_index_.clear();
+    cache_.clear();
+    if (!pending_.empty()) {
+        FlushPendingBlock();
+        ++released;
+    }
+    pending_.shrink_to_fit();
+    return released;
+}
+
+void ContentStore::FlushPendingBlock() {
+    if (!file_) {
+        file_ = tmpfile();
+        if (!file_) {
+            throw runtime_error("Cannot create content store file: "s + strerror(errno));
+        }
+    }
+    const string compressed = Compress(pending_);
+    size_t written = 0;
+    while (written < compressed.size()) {
+        const ssize_t count = pwrite(fileno(file_), compressed.data() + written, compressed.size() - written, file_size_ + written);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            throw runtime_error("Cannot write content store file: "s + strerror(errno));
+        }
+        written += count;
+    }
+    blocks_.push_back({ file_size_, static_cast<uint32_t>(compressed.size()), static_cast<uint32_t>(pending_.size()) });
+    file_size_ += compressed.size();
+    pending_.clear();
+}
+
+void ContentStore::LoadBlock(const Block& info, pmr::string& contents) const {
+    string compressed(info.compressed_size, '\0');
+    size_t read = 0;
+    while (read < compressed.size()) {
+        const ssize_t count = pread(fileno(file_), compressed.data() + read, compressed.size() - read, info.file_offset + read);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            throw runtime_error("Cannot read content store file"s);
+        }
+        read += count;
+    }
+    Decompress(compressed, info.size, contents);
+}
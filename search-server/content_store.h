@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Document text kept out of RAM. Texts are appended to a pending block; a full
+// block is compressed with a small LZ77 coder and written to an anonymous
+// temporary file. Reads go through an LRU cache of decompressed blocks, so only
+// the pending block and the cache are resident. Text of removed documents stays
+// in the file. The lock covers only the block table and the cache: reads of
+// blocks on disk and their decompression run concurrently.
+class ContentStore {
+public:
+    static constexpr size_t BLOCK_SIZE = 16 * 1024;
+    static constexpr size_t DEFAULT_CACHE_BLOCKS = 64;
+
+    explicit ContentStore(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+    ContentStore(const ContentStore&) = delete;
+    ContentStore& operator=(const ContentStore&) = delete;
+    ~ContentStore();
+
+    // Texts are numbered in the order they are appended, from 0.
+    void Append(std::string_view content);
+    std::string Get(size_t index) const;
+
+    size_t GetSize() const {
+        return locations_.size();
+    }
+
+    // Drops text first + i wherever keep[i] is 0 and renumbers the later texts to close
+    // the gaps. Only the index entries go; the bytes stay in the file.
+    void Erase(size_t first, const std::vector<char>& keep);
+
+    void SetCacheCapacity(size_t blocks);
+    // Bytes ReleaseMemory would free: the pending block and the cached blocks.
+    // Blocks already on disk are not resident and never count.
+    size_t GetReleasableBytes() const;
+    // Writes out the pending block and empties the cache; returns the number of
+    // blocks that were released from memory.
+    size_t ReleaseMemory();
+
+private:
+    struct Location {
+        uint32_t block;
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    struct Block {
+        uint64_t file_offset;
+        uint32_t compressed_size;
+        uint32_t size;
+    };
+
+    using CacheEntry = std::pair<uint32_t, std::pmr::string>;
+
+    // Expects mutex_ to be held.
+    void FlushPendingBlock();
+    // Reads and decompresses a written block; needs no lock.
+    void LoadBlock(const Block& info, std::pmr::string& contents) const;
+
+    std::pmr::vector<Location> locations_;
+    std::pmr::vector<Block> blocks_;
+    std::pmr::string pending_;
+    std::FILE* file_ = nullptr;
+    uint64_t file_size_ = 0;
+
+    size_t cache_capacity_ = DEFAULT_CACHE_BLOCKS;
+    mutable std::pmr::list<CacheEntry> cache_;
+    mutable std::pmr::unordered_map<uint32_t, std::pmr::list<CacheEntry>::iterator> cache_index_;
+    mutable std::mutex mutex_;
+};
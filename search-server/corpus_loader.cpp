@@ -0,0 +1,225 @@
+#include "corpus_loader.h"
+
+#include <algorithm>
+#include <charconv>
+#include <execution>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+constexpr size_t MIN_CHUNK_SIZE = 1 << 20;
+constexpr size_t CHUNKS_PER_THREAD = 4;
+
+class MappedFile {
+public:
+    explicit MappedFile(const string& path) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw runtime_error("Cannot open corpus file "s + path);
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            throw runtime_error("Cannot stat corpus file "s + path);
+        }
+        size_ = static_cast<size_t>(info.st_size);
+        if (size_ > 0) {
+            void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                close(fd);
+                throw runtime_error("Cannot map corpus file "s + path);
+            }
+            madvise(data, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(data);
+        }
+        close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (data_) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    string_view GetContents() const {
+        return { data_, size_ };
+    }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+struct Chunk {
+    string_view text;
+    size_t line_count = 0;
+    vector<DocumentRecord> records;
+    vector<size_t> record_lines;
+    vector<LoadError> errors;
+};
+
+template <typename Number>
+bool ParseNumber(string_view text, Number& value) {
+    const auto [end, error] = from_chars(text.data(), text.data() + text.size(), value);
+    return error == errc() && end == text.data() + text.size() && !text.empty();
+}
+
+bool ParseStatus(string_view text, DocumentStatus& status) {
+    static const pair<string_view, DocumentStatus> names[] = {
+        { "ACTUAL"sv, DocumentStatus::ACTUAL },
+        { "IRRELEVANT"sv, DocumentStatus::IRRELEVANT },
+        { "BANNED"sv, DocumentStatus::BANNED },
+        { "REMOVED"sv, DocumentStatus::REMOVED },
+    };
+    for (const auto& [name, value] : names) {
+        if (text == name) {
+            status = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+string_view NextField(string_view& line) {
+    const size_t tab = line.find('\t');
+    const string_view field = line.substr(0, tab);
+    line.remove_prefix(tab == string_view::npos ? line.size() : tab + 1);
+    return field;
+}
+
+// Returns an empty string on success, otherwise what is wrong with the line.
+string ParseLine(string_view line, DocumentRecord& record) {
+    const string_view id = NextField(line);
+    if (!ParseNumber(id, record.id)) {
+        return "Invalid document id \""s + string(id) + "\""s;
+    }
+    const string_view status = NextField(line);
+    if (!ParseStatus(status, record.status)) {
+        return "Invalid status \""s + string(status) + "\""s;
+    }
+    // The ratings field has to be followed by a tab even when the text is empty, so a
+    // line that stops after the ratings is not taken for an empty document.
+    const size_t tab = line.find('\t');
+    if (tab == string_view::npos) {
+        return "Expected 4 tab-separated fields"s;
+    }
+    string_view ratings = line.substr(0, tab);
+    line.remove_prefix(tab + 1);
+    while (!ratings.empty()) {
+        const size_t space = ratings.find(' ');
+        const string_view rating = ratings.substr(0, space);
+        ratings.remove_prefix(space == string_view::npos ? ratings.size() : space + 1);
+        if (rating.empty()) {
+            continue;
+        }
+        int value = 0;
+        if (!ParseNumber(rating, value)) {
+            return "Invalid rating \""s + string(rating) + "\""s;
+        }
+        record.ratings.push_back(value);
+    }
+    record.text = line;
+    return {};
+}
+
+void ParseChunk(Chunk& chunk) {
+    string_view text = chunk.text;
+    while (!text.empty()) {
+        const size_t newline = text.find('\n');
+        string_view line = text.substr(0, newline);
+        text.remove_prefix(newline == string_view::npos ? text.size() : newline + 1);
+        ++chunk.line_count;
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        if (line.empty()) {
+            continue;
+        }
+        DocumentRecord record;
+        string error = ParseLine(line, record);
+        if (!error.empty()) {
+            chunk.errors.push_back({ chunk.line_count, move(error) });
+            continue;
+        }
+        chunk.records.push_back(move(record));
+        chunk.record_lines.push_back(chunk.line_count);
+    }
+}
+
+vector<Chunk> SplitIntoChunks(string_view corpus) {
+    const size_t threads = max<size_t>(thread::hardware_concurrency(), 1);
+    const size_t chunk_size = max(MIN_CHUNK_SIZE, corpus.size() / (threads * CHUNKS_PER_THREAD) + 1);
+    vector<Chunk> chunks;
+    while (!corpus.empty()) {
+        size_t end = corpus.find('\n', min(chunk_size, corpus.size()) - 1);
+        end = end == string_view::npos ? corpus.size() : end + 1;
+        chunks.emplace_back().text = corpus.substr(0, end);
+        corpus.remove_prefix(end);
+    }
+    return chunks;
+}
+
+} // namespace
+
+double LoadReport::GetMegabytesPerSecond() const {
+    const double seconds = chrono::duration<double>(elapsed).count();
+    return seconds > 0 ? bytes / (1024.0 * 1024.0) / seconds : 0.0;
+}
+
+LoadReport LoadCorpus(SearchServer& search_server, const string& path) {
+    const auto start_time = chrono::steady_clock::now();
+    const MappedFile file(path);
+    LoadReport report = LoadCorpus(search_server, file.GetContents());
+    report.elapsed = chrono::steady_clock::now() - start_time;
+    return report;
+}
+
+LoadReport LoadCorpus(SearchServer& search_server, string_view corpus) {
+    const auto start_time = chrono::steady_clock::now();
+    LoadReport report;
+    report.bytes = corpus.size();
+
+    vector<Chunk> chunks = SplitIntoChunks(corpus);
+    for_each(execution::par, chunks.begin(), chunks.end(), ParseChunk);
+
+    for (Chunk& chunk : chunks) {
+        const size_t first_line = report.lines;
+        vector<LoadError> errors = move(chunk.errors);
+        const vector<RejectedDocument> rejected_documents = search_server.AddDocuments(chunk.records);
+        for (const RejectedDocument& rejected : rejected_documents) {
+            errors.push_back({ chunk.record_lines[rejected.index], rejected.reason });
+        }
+        sort(errors.begin(), errors.end(), [](const LoadError& lhs, const LoadError& rhs) {
+            return lhs.line < rhs.line;
+            });
+        for (LoadError& error : errors) {
+            error.line += first_line;
+            report.errors.push_back(move(error));
+        }
+        report.documents_loaded += chunk.records.size() - rejected_documents.size();
+        report.lines += chunk.line_count;
+    }
+    report.elapsed = chrono::steady_clock::now() - start_time;
+    return report;
+}
+
+ostream& operator<<(ostream& out, const LoadReport& report) {
+    out << "loaded "s << report.documents_loaded << " documents from "s << report.lines << " lines ("s
+        << report.bytes << " bytes) in "s << chrono::duration_cast<chrono::milliseconds>(report.elapsed).count()
+        << " ms, "s << report.GetMegabytesPerSecond() << " MB/s, "s << report.errors.size() << " errors"s << endl;
+    for (const LoadError& error : report.errors) {
+        out << "  line "s << error.line << ": "s << error.message << endl;
+    }
+    return out;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "search_server.h"
+
+// Bulk loading of a corpus file with one document per line:
+//
+//     <id> TAB <status> TAB <ratings> TAB <text>
+//
+// status is one of ACTUAL, IRRELEVANT, BANNED, REMOVED; ratings are integers
+// separated by spaces and may be empty. Empty lines are skipped. The file is
+// memory-mapped and split into chunks on line boundaries that are parsed in
+// parallel without copying the text; each chunk is then added with
+// SearchServer::AddDocuments. Malformed lines and rejected documents do not stop
+// the load, they are listed in the report.
+
+struct LoadError {
+    size_t line = 0;
+    std::string message;
+};
+
+struct LoadReport {
+    size_t documents_loaded = 0;
+    size_t lines = 0;
+    size_t bytes = 0;
+    std::chrono::nanoseconds elapsed{ 0 };
+    std::vector<LoadError> errors;
+
+    double GetMegabytesPerSecond() const;
+};
+
+LoadReport LoadCorpus(SearchServer& search_server, const std::string& path);
+LoadReport LoadCorpus(SearchServer& search_server, std::string_view corpus);
+
+std::ostream& operator<<(std::ostream& out, const LoadReport& report);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <iostream>
+#include <map>
 #include <vector>
 #include <string>
 #include <string_view>
@@ -14,6 +15,11 @@ struct Document {
     int rating = 0;
 };
 
+struct SearchResult {
+    std::vector<Document> documents;
+    bool partial = false;
+};
+
 enum class DocumentStatus {
     ACTUAL,
     IRRELEVANT,
@@ -21,6 +27,34 @@ enum class DocumentStatus {
     REMOVED,
 };
 
+// ANY_WORDS matches documents holding at least one plus word of the query,
+// ALL_WORDS only those holding every one of them.
+enum class QueryMode {
+    ANY_WORDS,
+    ALL_WORDS,
+};
+
+// One document of a batch for SearchServer::AddDocuments; the text is only read
+// during the call.
+struct DocumentRecord {
+    int id = 0;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    std::vector<int> ratings;
+    std::string_view text;
+};
+
+struct RejectedDocument {
+    size_t index = 0;
+    std::string reason;
+};
+
+// Document frequencies summed over every shard of a collection, so each shard
+// scores with the IDF of the whole collection rather than its own.
+struct CollectionStats {
+    int document_count = 0;
+    std::map<std::string, int, std::less<>> document_freqs;
+};
+
 std::ostream& operator<<(std::ostream& out, const Document& document);
 void PrintDocument(const Document& document);
 void PrintMatchDocumentResult(int document_id, std::vector<std::string_view> words, DocumentStatus status);
@@ -0,0 +1,174 @@
+#include "index_segment.h"
+
+#include <algorithm>
+
+using namespace std;
+
+void MutableSegment::AddDocument(int ordinal, const vector<pair<int, double>>& term_freqs) {
+    if (document_count_ == 0) {
+        first_ordinal_ = ordinal;
+    }
+    for (const auto& [term_id, term_freq] : term_freqs) {
+        if (static_cast<size_t>(term_id) >= ordinals_.size()) {
+            ordinals_.resize(term_id + 1);
+            term_freqs_.resize(term_id + 1);
+        }
+        if (ordinals_[term_id].empty()) {
+            term_ids_.push_back(term_id);
+        }
+        ordinals_[term_id].push_back(ordinal);
+        term_freqs_[term_id].push_back(term_freq);
+    }
+    ++document_count_;
+}
+
+PostingList MutableSegment::FindPostings(int term_id) const {
+    if (static_cast<size_t>(term_id) >= ordinals_.size()) {
+        return {};
+    }
+    return { ordinals_[term_id].data(), term_freqs_[term_id].data(), ordinals_[term_id].size() };
+}
+
+void MutableSegment::Clear() {
+    for (const int term_id : term_ids_) {
+        ordinals_[term_id].clear();
+        ordinals_[term_id].shrink_to_fit();
+        term_freqs_[term_id].clear();
+        term_freqs_[term_id].shrink_to_fit();
+    }
+    term_ids_.clear();
+    document_count_ = 0;
+}
+
+void MutableSegment::Renumber(int offset) {
+    for (const int term_id : term_ids_) {
+        for (int& ordinal : ordinals_[term_id]) {
+            ordinal += offset;
+        }
+    }
+    first_ordinal_ += offset;
+}
+
+shared_ptr<const IndexSegment> IndexSegment::Build(const MutableSegment& segment, int end_ordinal,
+    const char* alive, int alive_base, pmr::memory_resource* resource) {
+    auto result = allocate_shared<IndexSegment>(pmr::polymorphic_allocator<IndexSegment>(resource), resource);
+    result->first_ordinal_ = segment.first_ordinal_;
+    result->end_ordinal_ = end_ordinal;
+
+    vector<int> term_ids(segment.term_ids_.begin(), segment.term_ids_.end());
+    sort(term_ids.begin(), term_ids.end());
+    size_t posting_count = 0;
+    for (const int term_id : term_ids) {
+        posting_count += segment.ordinals_[term_id].size();
+    }
+
+    result->term_ids_.reserve(term_ids.size());
+    result->term_offsets_.reserve(term_ids.size() + 1);
+    result->term_offsets_.push_back(0);
+    result->ordinals_.reserve(posting_count);
+    result->term_freqs_.reserve(posting_count);
+    for (const int term_id : term_ids) {
+        const auto& ordinals = segment.ordinals_[term_id];
+        const auto& term_freqs = segment.term_freqs_[term_id];
+        for (size_t i = 0; i < ordinals.size(); ++i) {
+            if (alive[ordinals[i] - alive_base]) {
+                result->AppendPosting(ordinals[i], term_freqs[i]);
+            }
+        }
+        result->AppendTerm(term_id);
+    }
+    result->ordinals_.shrink_to_fit();
+    result->term_freqs_.shrink_to_fit();
+    return result;
+}
+
+shared_ptr<const IndexSegment> IndexSegment::Merge(const vector<shared_ptr<const IndexSegment>>& segments,
+    const int* new_ordinals, int first_ordinal, int end_ordinal, pmr::memory_resource* resource) {
+    auto result = allocate_shared<IndexSegment>(pmr::polymorphic_allocator<IndexSegment>(resource), resource);
+    const int base = segments.front()->first_ordinal_;
+    result->first_ordinal_ = first_ordinal;
+    result->end_ordinal_ = end_ordinal;
+    result->term_offsets_.push_back(0);
+    for (const auto& segment : segments) {
+        result->level_ = max(result->level_, segment->level_ + 1);
+    }
+    // Rewriting a single segment only drops its removed documents.
+    if (segments.size() == 1) {
+        result->level_ = segments.front()->level_;
+    }
+
+    // Segments cover consecutive ordinal ranges, so concatenating a term's postings
+    // in segment order keeps them sorted.
+    vector<size_t> cursors(segments.size(), 0);
+    while (true) {
+        const int* smallest = nullptr;
+        for (size_t i = 0; i < segments.size(); ++i) {
+            const auto& term_ids = segments[i]->term_ids_;
+            if (cursors[i] < term_ids.size() && (!smallest || term_ids[cursors[i]] < *smallest)) {
+                smallest = &term_ids[cursors[i]];
+            }
+        }
+        if (!smallest) {
+            break;
+        }
+
+        const int term_id = *smallest;
+        for (size_t i = 0; i < segments.size(); ++i) {
+            const IndexSegment& segment = *segments[i];
+            if (cursors[i] == segment.term_ids_.size() || segment.term_ids_[cursors[i]] != term_id) {
+                continue;
+            }
+            const size_t begin = segment.term_offsets_[cursors[i]];
+            const size_t end = segment.term_offsets_[cursors[i] + 1];
+            for (size_t p = begin; p < end; ++p) {
+                const int ordinal = new_ordinals[segment.ordinals_[p] - base];
+                if (ordinal >= 0) {
+                    result->AppendPosting(ordinal, segment.term_freqs_[p]);
+                }
+            }
+            ++cursors[i];
+        }
+        result->AppendTerm(term_id);
+    }
+    result->ordinals_.shrink_to_fit();
+    result->term_freqs_.shrink_to_fit();
+    return result;
+}
+
+shared_ptr<const IndexSegment> IndexSegment::Renumber(const IndexSegment& segment, int offset, pmr::memory_resource* resource) {
+    auto result = allocate_shared<IndexSegment>(pmr::polymorphic_allocator<IndexSegment>(resource), resource);
+    result->term_ids_.assign(segment.term_ids_.begin(), segment.term_ids_.end());
+    result->term_offsets_.assign(segment.term_offsets_.begin(), segment.term_offsets_.end());
+    result->ordinals_.reserve(segment.ordinals_.size());
+    for (const int ordinal : segment.ordinals_) {
+        result->ordinals_.push_back(ordinal + offset);
+    }
+    result->term_freqs_.assign(segment.term_freqs_.begin(), segment.term_freqs_.end());
+    result->first_ordinal_ = segment.first_ordinal_ + offset;
+    result->end_ordinal_ = segment.end_ordinal_ + offset;
+    result->level_ = segment.level_;
+    return result;
+}
+
+PostingList IndexSegment::FindPostings(int term_id) const {
+    const auto it = lower_bound(term_ids_.begin(), term_ids_.end(), term_id);
+    if (it == term_ids_.end() || *it != term_id) {
+        return {};
+    }
+    const size_t index = it - term_ids_.begin();
+    const size_t begin = term_offsets_[index];
+    return { ordinals_.data() + begin, term_freqs_.data() + begin, term_offsets_[index + 1] - begin };
+}
+
+void IndexSegment::AppendTerm(int term_id) {
+    if (ordinals_.size() == term_offsets_.back()) {
+        return;
+    }
+    term_ids_.push_back(term_id);
+    term_offsets_.push_back(ordinals_.size());
+}
+
+void IndexSegment::AppendPosting(int ordinal, double term_freq) {
+    ordinals_.push_back(ordinal);
+    term_freqs_.push_back(term_freq);
+}
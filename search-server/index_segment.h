@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+
+// Postings of one term inside one segment, sorted by ordinal. Segments are keyed
+// by the term ids of the server's TermDictionary.
+struct PostingList {
+    const int* ordinals = nullptr;
+    const double* term_freqs = nullptr;
+    size_t size = 0;
+};
+
+// First position in [first, last) whose ordinal is not less than `ordinal`. Probes
+// at doubling distances and binary searches the last step, so moving a cursor d
+// positions ahead costs O(log d).
+inline const int* GallopTo(const int* first, const int* last, int ordinal) {
+    if (first == last || *first >= ordinal) {
+        return first;
+    }
+    const size_t size = last - first;
+    size_t bound = 1;
+    while (bound < size && first[bound] < ordinal) {
+        bound *= 2;
+    }
+    return std::lower_bound(first + bound / 2 + 1, first + std::min(bound, size), ordinal);
+}
+
+// Small write-optimized segment that receives new documents. Ordinals only grow,
+// so appending keeps every posting list sorted without any rebalancing.
+class MutableSegment {
+public:
+    explicit MutableSegment(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : ordinals_(resource)
+        , term_freqs_(resource)
+        , term_ids_(resource) {
+    }
+
+    void AddDocument(int ordinal, const std::vector<std::pair<int, double>>& term_freqs);
+    PostingList FindPostings(int term_id) const;
+
+    size_t GetDocumentCount() const {
+        return document_count_;
+    }
+
+    int GetFirstOrdinal() const {
+        return first_ordinal_;
+    }
+
+    void Clear();
+    // Moves every ordinal by `offset`.
+    void Renumber(int offset);
+
+private:
+    friend class IndexSegment;
+
+    // Indexed by term id.
+    std::pmr::vector<std::pmr::vector<int>> ordinals_;
+    std::pmr::vector<std::pmr::vector<double>> term_freqs_;
+    std::pmr::vector<int> term_ids_;
+    size_t document_count_ = 0;
+    int first_ordinal_ = 0;
+};
+
+// Immutable, compactly laid out postings for a contiguous range of ordinals: a
+// sorted term id array with offsets into flat ordinal and term frequency arrays.
+class IndexSegment {
+public:
+    explicit IndexSegment(std::pmr::memory_resource* resource)
+        : term_ids_(resource)
+        , term_offsets_(resource)
+        , ordinals_(resource)
+        , term_freqs_(resource) {
+    }
+
+    // alive[ordinal - alive_base] tells whether a document is still live; removed
+    // documents are dropped while the segment is written. The new segment is
+    // allocated from `resource`.
+    static std::shared_ptr<const IndexSegment> Build(const MutableSegment& segment, int end_ordinal,
+        const char* alive, int alive_base, std::pmr::memory_resource* resource);
+    // new_ordinals[ordinal - first ordinal of `segments`] is the ordinal a posting is
+    // written with, or -1 to drop it (a removed document). Renumbering has to keep the
+    // ordinals in order; the merged segment covers [first_ordinal, end_ordinal).
+    static std::shared_ptr<const IndexSegment> Merge(const std::vector<std::shared_ptr<const IndexSegment>>& segments,
+        const int* new_ordinals, int first_ordinal, int end_ordinal, std::pmr::memory_resource* resource);
+    // A copy with every ordinal moved by `offset`.
+    static std::shared_ptr<const IndexSegment> Renumber(const IndexSegment& segment, int offset, std::pmr::memory_resource* resource);
+
+    PostingList FindPostings(int term_id) const;
+
+    int GetFirstOrdinal() const {
+        return first_ordinal_;
+    }
+
+    int GetEndOrdinal() const {
+        return end_ordinal_;
+    }
+
+    int GetLevel() const {
+        return level_;
+    }
+
+    size_t GetPostingCount() const {
+        return ordinals_.size();
+    }
+
+private:
+    void AppendTerm(int term_id);
+    void AppendPosting(int ordinal, double term_freq);
+
+    std::pmr::vector<int> term_ids_;
+    std::pmr::vector<size_t> term_offsets_;
+    std::pmr::vector<int> ordinals_;
+    std::pmr::vector<double> term_freqs_;
+    int first_ordinal_ = 0;
+    int end_ordinal_ = 0;
+    int level_ = 0;
+};
@@ -56,18 +56,71 @@ int main() {
 #endif // WORK
 #ifdef TESTS
 
+#include "concurrent_request_queue.h"
+#include "corpus_loader.h"
+#include "request_queue.h"
 #include "search_server.h"
 
 #include "log_duration.h"
+#include "scoring_kernel.h"
+#include "shard_coordinator.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
 #include <execution>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <new>
+#include <numeric>
+#include <mutex>
 #include <random>
+#include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
 using namespace std;
 
+atomic<size_t> allocation_count{ 0 };
+
+void* operator new(size_t size) {
+    allocation_count.fetch_add(1, memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void* operator new(size_t size, align_val_t alignment) {
+    allocation_count.fetch_add(1, memory_order_relaxed);
+    const size_t align = static_cast<size_t>(alignment);
+    if (void* p = aligned_alloc(align, (size + align - 1) / align * align)) {
+        return p;
+    }
+    throw bad_alloc();
+}
+
+void operator delete(void* p, align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t, align_val_t) noexcept {
+    free(p);
+}
+
 string GenerateWord(mt19937& generator, int max_length) {
     const int length = uniform_int_distribution(1, max_length)(generator);
     string word;
@@ -111,6 +164,29 @@ vector<string> GenerateQueries(mt19937& generator, const vector<string>& diction
     return queries;
 }
 
+// Draws words with probability proportional to 1 / rank, so the first few words
+// of the dictionary dominate posting volume.
+vector<string> GenerateZipfQueries(mt19937& generator, const vector<string>& dictionary, int query_count, int word_count) {
+    vector<double> weights(dictionary.size());
+    for (size_t i = 0; i < weights.size(); ++i) {
+        weights[i] = 1.0 / (i + 1);
+    }
+    discrete_distribution<size_t> distribution(weights.begin(), weights.end());
+    vector<string> queries;
+    queries.reserve(query_count);
+    for (int i = 0; i < query_count; ++i) {
+        string query;
+        for (int j = 0; j < word_count; ++j) {
+            if (!query.empty()) {
+                query.push_back(' ');
+            }
+            query += dictionary[distribution(generator)];
+        }
+        queries.push_back(move(query));
+    }
+    return queries;
+}
+
 template <typename ExecutionPolicy>
 void Test(string_view mark, const SearchServer& search_server, const vector<string>& queries, ExecutionPolicy&& policy) {
     LOG_DURATION(mark);
@@ -125,9 +201,647 @@ void Test(string_view mark, const SearchServer& search_server, const vector<stri
     cout << total_relevance << endl;
 }
 
+template <typename ExecutionPolicy>
+void TestAllocations(string_view mark, const SearchServer& search_server, const vector<string>& queries, ExecutionPolicy&& policy) {
+    const size_t before = allocation_count.load();
+    for (const string_view query : queries) {
+        search_server.FindTopDocuments(policy, query);
+    }
+    cout << mark << ": "s << (allocation_count.load() - before) / queries.size() << " allocations per query"s << endl;
+}
+
+// Feeds the accumulator a synthetic posting list directly, so the number is the
+// kernel's own throughput on one core rather than that of a whole query.
+void TestScoring(mt19937& generator) {
+    constexpr int DOCUMENT_COUNT = 1 << 20;
+    constexpr size_t BLOCK_SIZE = 1024;
+    constexpr int PASSES = 20;
+    vector<int> ordinals;
+    bernoulli_distribution contains(0.5);
+    for (int ordinal = 0; ordinal < DOCUMENT_COUNT; ++ordinal) {
+        if (contains(generator)) {
+            ordinals.push_back(ordinal);
+        }
+    }
+    uniform_real_distribution<double> term_freq(0.0, 0.1);
+    vector<double> term_freqs(ordinals.size());
+    for (double& value : term_freqs) {
+        value = term_freq(generator);
+    }
+    vector<uint8_t> mask(ordinals.size());
+    for (uint8_t& value : mask) {
+        value = contains(generator);
+    }
+
+    const ScoringKernel default_kernel = GetScoringKernel();
+    ScoreAccumulator accumulator;
+    for (const ScoringKernel kernel : { ScoringKernel::SCALAR, ScoringKernel::AVX2, ScoringKernel::AVX512 }) {
+        if (!IsScoringKernelSupported(kernel)) {
+            continue;
+        }
+        SetScoringKernel(kernel);
+        for (const ScoringPrecision precision : { ScoringPrecision::DOUBLE, ScoringPrecision::FLOAT }) {
+            accumulator.Start(0, DOCUMENT_COUNT, precision);
+            for (const int ordinal : ordinals) {
+                accumulator.Visit(ordinal);
+                accumulator.Accept(ordinal);
+            }
+            const auto start_time = chrono::steady_clock::now();
+            for (int pass = 0; pass < PASSES; ++pass) {
+                for (size_t begin = 0; begin < ordinals.size(); begin += BLOCK_SIZE) {
+                    accumulator.ScoreBlock(ordinals.data() + begin, term_freqs.data() + begin, mask.data() + begin,
+                        min(BLOCK_SIZE, ordinals.size() - begin), 1.5);
+                }
+            }
+            const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+            double total_relevance = 0;
+            accumulator.ForEachAccepted([&total_relevance](int, double relevance) {
+                total_relevance += relevance;
+                });
+            cout << GetScoringKernelName(kernel) << (precision == ScoringPrecision::DOUBLE ? " double: "s : " float: "s)
+                << ordinals.size() * PASSES / seconds / 1e6 << " M postings/s ("s << total_relevance << ")"s << endl;
+        }
+    }
+    SetScoringKernel(default_kernel);
+}
+
+// Every kernel must reproduce the scalar double scores exactly. Blocks are scored
+// several times so the accumulation order matters, and the block sizes leave tails
+// for the scalar remainder loops.
+void TestScoringKernelsIdentical() {
+    constexpr int DOCUMENT_COUNT = 5000;
+    mt19937 generator(7);
+    vector<int> ordinals(DOCUMENT_COUNT);
+    iota(ordinals.begin(), ordinals.end(), 100);
+    shuffle(ordinals.begin(), ordinals.end(), generator);
+    uniform_real_distribution<double> term_freq(0.0, 1.0);
+    vector<double> term_freqs(DOCUMENT_COUNT);
+    for (double& value : term_freqs) {
+        value = term_freq(generator);
+    }
+    bernoulli_distribution accepted(0.7);
+    vector<uint8_t> mask(DOCUMENT_COUNT);
+    for (uint8_t& value : mask) {
+        value = accepted(generator);
+    }
+
+    const auto score = [&](ScoringKernel kernel) {
+        SetScoringKernel(kernel);
+        ScoreAccumulator accumulator;
+        accumulator.Start(100, 100 + DOCUMENT_COUNT, ScoringPrecision::DOUBLE);
+        for (int i = 0; i < DOCUMENT_COUNT; ++i) {
+            accumulator.Visit(ordinals[i]);
+            if (mask[i]) {
+                accumulator.Accept(ordinals[i]);
+            }
+        }
+        for (const size_t block_size : { 1000, 13, 7, 1 }) {
+            const double inverse_document_freq = log(DOCUMENT_COUNT * 1.0 / block_size);
+            for (size_t begin = 0; begin < ordinals.size(); begin += block_size) {
+                accumulator.ScoreBlock(ordinals.data() + begin, term_freqs.data() + begin, mask.data() + begin,
+                    min(block_size, ordinals.size() - begin), inverse_document_freq);
+            }
+        }
+        vector<pair<int, double>> scores;
+        accumulator.ForEachAccepted([&scores](int ordinal, double relevance) {
+            scores.emplace_back(ordinal, relevance);
+            });
+        return scores;
+    };
+
+    const ScoringKernel default_kernel = GetScoringKernel();
+    const auto expected = score(ScoringKernel::SCALAR);
+    for (const ScoringKernel kernel : { ScoringKernel::AVX2, ScoringKernel::AVX512 }) {
+        if (IsScoringKernelSupported(kernel)) {
+            assert(score(kernel) == expected);
+        }
+    }
+    SetScoringKernel(default_kernel);
+    cout << "scoring kernels identical: OK"s << endl;
+}
+
+// Impact-ordered lists stop early, but must return exactly the exhaustive top
+// documents: same ids, same order, same relevance bits.
+void TestImpactOrderingExact() {
+    mt19937 generator(11);
+    const vector<string> dictionary = GenerateDictionary(generator, 60, 4);
+    SearchServer impact_server("and"s);
+    SearchServer exhaustive_server("and"s);
+    const auto add = [&](int id) {
+        const string text = GenerateQuery(generator, dictionary, uniform_int_distribution(1, 30)(generator));
+        const DocumentStatus status = id % 7 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        const vector<int> ratings{ id % 11 - 5, id % 3 };
+        impact_server.AddDocument(id, text, status, ratings);
+        exhaustive_server.AddDocument(id, text, status, ratings);
+    };
+    const auto remove = [&](int id) {
+        impact_server.RemoveDocument(id);
+        exhaustive_server.RemoveDocument(id);
+    };
+    const auto check = [&] {
+        const auto same = [](const vector<Document>& lhs, const vector<Document>& rhs) {
+            return equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](const Document& l, const Document& r) {
+                return l.id == r.id && l.rating == r.rating && l.relevance == r.relevance;
+                });
+        };
+        const auto even_ids = [](int document_id, DocumentStatus, int) {
+            return document_id % 2 == 0;
+        };
+        const auto positive = [](int, DocumentStatus status, int rating) {
+            return status == DocumentStatus::ACTUAL && rating > 0;
+        };
+        for (int i = 0; i < 200; ++i) {
+            const string query = GenerateQuery(generator, dictionary, i % 3 + 1, i % 4 == 0 ? 0.3 : 0.0);
+            assert(same(impact_server.FindTopDocuments(query), exhaustive_server.FindTopDocuments(query)));
+            assert(same(impact_server.FindTopDocuments(query, DocumentStatus::BANNED), exhaustive_server.FindTopDocuments(query, DocumentStatus::BANNED)));
+            assert(same(impact_server.FindTopDocuments(query, even_ids), exhaustive_server.FindTopDocuments(query, even_ids)));
+            assert(same(impact_server.FindTopDocuments(query, positive), exhaustive_server.FindTopDocuments(query, positive)));
+        }
+    };
+
+    for (int id = 0; id < 500; ++id) {
+        add(id);
+    }
+    impact_server.EnableImpactOrdering(true);
+    check();
+    for (int id = 0; id < 500; id += 3) {
+        remove(id);
+    }
+    check();
+    for (int id = 500; id < 700; ++id) {
+        add(id);
+    }
+    for (int id = 0; id < 500; id += 6) {
+        add(id);
+    }
+    check();
+    cout << "impact ordering exact: OK"s << endl;
+}
+
+// Text must come back byte for byte whether it sits in the pending block, in the
+// cache or only on disk, and whatever the memory budget evicted.
+void TestContentStoreRoundTrip() {
+    mt19937 generator(13);
+    SearchServer search_server("and"s);
+    map<int, string> texts;
+    const auto add = [&](int id, string text) {
+        search_server.AddDocument(id, text, DocumentStatus::ACTUAL, { 1 });
+        texts[id] = move(text);
+    };
+    const auto check = [&] {
+        for (const auto& [id, text] : texts) {
+            assert(search_server.GetDocumentContent(id) == text);
+        }
+    };
+
+    // Many small documents span several blocks; a few are larger than a whole block.
+    for (int id = 0; id < 3000; ++id) {
+        add(id, GenerateQuery(generator, { "cat"s, "dog"s, "bird"s, "fish"s }, uniform_int_distribution(1, 20)(generator)));
+    }
+    for (int id = 3000; id < 3004; ++id) {
+        string text;
+        while (text.size() < 20 * 1024 * static_cast<size_t>(id - 2999)) {
+            text += GenerateWord(generator, 12) + " "s;
+        }
+        add(id, text + "end"s);
+    }
+    add(3004, "tail"s);
+    check();
+
+    search_server.SetContentCacheCapacity(0);
+    check();
+    search_server.SetContentCacheCapacity(2);
+    check();
+
+    // Fill the cache, then shrink the budget below current usage so only eviction
+    // makes room for the next document.
+    search_server.SetContentCacheCapacity(64);
+    check();
+    const MemoryUsage usage = search_server.GetMemoryUsage();
+    search_server.SetMemoryBudget(usage.GetTotalBytes() - usage.Bytes(MemoryCategory::DOCUMENT_CONTENT) / 2,
+        MemoryBudgetPolicy::EVICT_CONTENT);
+    add(4000, "cat evicted"s);
+    assert(search_server.GetMetrics().Counter(SearchCounter::CONTENTS_EVICTED) > 0);
+    search_server.SetMemoryBudget(UNLIMITED_MEMORY);
+    check();
+    cout << "content store round trip: OK"s << endl;
+}
+
+// Tiny segments force many flushes and merges while ids are removed and re-added;
+// afterwards the server must answer exactly like one built from the final documents
+// alone, and merged segments must have dropped the tombstones' word counts.
+void TestSegmentMerges() {
+    mt19937 generator(17);
+    const vector<string> dictionary = GenerateDictionary(generator, 40, 5);
+    SearchServer segmented_server("and"s);
+    segmented_server.SetSegmentFlushThreshold(4);
+    segmented_server.EnableImpactOrdering(true);
+    map<int, string> texts;
+    const auto add = [&](int id) {
+        texts[id] = GenerateQuery(generator, dictionary, uniform_int_distribution(1, 12)(generator));
+        segmented_server.AddDocument(id, texts[id], DocumentStatus::ACTUAL, { id });
+    };
+    for (int id = 0; id < 300; ++id) {
+        add(id);
+        if (id % 5 == 4) {
+            segmented_server.RemoveDocument(id - 2);
+            texts.erase(id - 2);
+        }
+        if (id % 10 == 9) {
+            add(id - 7);
+        }
+    }
+    for (int round = 0; round < 3; ++round) {
+        for (int id = round; id < 300; id += 4) {
+            if (texts.count(id)) {
+                segmented_server.RemoveDocument(id);
+            }
+            add(id);
+        }
+    }
+    segmented_server.WaitForMerges();
+    assert(segmented_server.GetSegmentCount() < 300 / 4);
+    // Merges renumber, so the churn above must not leave a slot behind per removal.
+    assert(segmented_server.GetMemoryUsage().dead_ordinals < texts.size() / 2);
+
+    SearchServer reference_server("and"s);
+    for (const auto& [id, text] : texts) {
+        reference_server.AddDocument(id, text, DocumentStatus::ACTUAL, { id });
+    }
+    assert(segmented_server.GetDocumentCount() == reference_server.GetDocumentCount());
+
+    for (int i = 0; i < 200; ++i) {
+        const string query = GenerateQuery(generator, dictionary, i % 4 + 1, 0.2);
+        const vector<Document> segmented = segmented_server.FindTopDocuments(query);
+        const vector<Document> reference = reference_server.FindTopDocuments(query);
+        assert(equal(segmented.begin(), segmented.end(), reference.begin(), reference.end(), [](const Document& lhs, const Document& rhs) {
+            return lhs.id == rhs.id && lhs.rating == rhs.rating && lhs.relevance == rhs.relevance;
+            }));
+        const int id = next(texts.begin(), i % texts.size())->first;
+        assert(segmented_server.MatchDocument(query, id) == reference_server.MatchDocument(query, id));
+    }
+    for (const auto& [id, text] : texts) {
+        const vector<string_view> words = SplitIntoWords(text);
+        map<string_view, double> expected;
+        for (const string_view word : words) {
+            expected[word] += 1.0 / words.size();
+        }
+        assert(segmented_server.GetDocumentContent(id) == text);
+        const auto& actual = segmented_server.GetWordFrequencies(id);
+        assert(actual.size() == expected.size());
+        for (const auto& [word, frequency] : expected) {
+            assert(abs(actual.at(word) - frequency) < 1e-12);
+        }
+    }
+    cout << "segment merges: OK"s << endl;
+}
+
+// Prefix words expand to the same terms whether they sit in the trie, in the terms
+// added while it was rebuilt, or in both around a swap.
+void TestPrefixExpansion() {
+    mt19937 generator(23);
+    const vector<string> dictionary = GenerateDictionary(generator, 400, 4);
+    SearchServer search_server(""s);
+    search_server.SetSegmentFlushThreshold(3);
+    map<int, string> texts;
+    const auto check = [&] {
+        for (const string& prefix : { "a"s, "ca"s, "q"s, "zz"s }) {
+            for (const auto& [id, text] : texts) {
+                set<string_view> expected;
+                for (const string_view word : SplitIntoWords(text)) {
+                    if (word.substr(0, prefix.size()) == prefix) {
+                        expected.insert(word);
+                    }
+                }
+                const auto [matched, status] = search_server.MatchDocument(prefix + "*"s, id);
+                assert(equal(matched.begin(), matched.end(), expected.begin(), expected.end()));
+            }
+        }
+    };
+    for (int id = 0; id < 120; ++id) {
+        texts[id] = GenerateQuery(generator, dictionary, uniform_int_distribution(1, 8)(generator));
+        search_server.AddDocument(id, texts[id], DocumentStatus::ACTUAL, { id });
+        if (id % 20 == 19) {
+            check();
+        }
+    }
+    search_server.WaitForMerges();
+    check();
+    cout << "prefix expansion: OK"s << endl;
+}
+
+// With ALL_WORDS a prefix word is satisfied by any one of its terms.
+void TestAllWordsPrefix() {
+    SearchServer search_server(""s);
+    // Spread over two segments and the mutable one.
+    search_server.SetSegmentFlushThreshold(2);
+    search_server.AddDocument(1, "cat dog"s, DocumentStatus::ACTUAL, { 1 });
+    search_server.AddDocument(2, "car dog"s, DocumentStatus::ACTUAL, { 2 });
+    search_server.AddDocument(3, "cat car"s, DocumentStatus::ACTUAL, { 3 });
+    search_server.AddDocument(4, "cow dog"s, DocumentStatus::ACTUAL, { 4 });
+    search_server.AddDocument(5, "bird"s, DocumentStatus::ACTUAL, { 5 });
+    const auto ids = [&search_server](const string& query) {
+        set<int> result;
+        for (const Document& document : search_server.FindTopDocuments(QueryMode::ALL_WORDS, query)) {
+            result.insert(document.id);
+        }
+        return result;
+    };
+    assert(ids("ca* dog"s) == set<int>({ 1, 2 }));
+    assert(ids("zz* dog"s).empty());
+    assert(ids("ca* c*"s) == set<int>({ 1, 2, 3 }));
+    assert(ids("ca* dog -cat"s) == set<int>({ 2 }));
+    assert(ids("ca* -car"s) == set<int>({ 1 }));
+
+    // Scores are those of the same query in ANY_WORDS mode, which matches exactly
+    // the documents both return.
+    const vector<Document> all_words = search_server.FindTopDocuments(QueryMode::ALL_WORDS, "ca* dog"s);
+    const vector<Document> any_words = search_server.FindTopDocuments("ca* dog"s);
+    for (const Document& document : all_words) {
+        const auto it = find_if(any_words.begin(), any_words.end(), [&document](const Document& other) {
+            return other.id == document.id;
+            });
+        assert(it != any_words.end() && it->relevance == document.relevance);
+    }
+
+    // Random prefix queries against a brute-force check of every document.
+    mt19937 generator(5);
+    const vector<string> dictionary = GenerateDictionary(generator, 60, 3);
+    SearchServer random_server(""s);
+    random_server.SetSegmentFlushThreshold(7);
+    map<int, string> texts;
+    for (int id = 0; id < 150; ++id) {
+        texts[id] = GenerateQuery(generator, dictionary, uniform_int_distribution(1, 10)(generator));
+        random_server.AddDocument(id, texts[id], DocumentStatus::ACTUAL, { id });
+    }
+    for (int id = 0; id < 150; id += 9) {
+        random_server.RemoveDocument(id);
+        texts.erase(id);
+    }
+    for (int i = 0; i < 60; ++i) {
+        vector<string> words;
+        string query;
+        for (int k = i % 3; k >= 0; --k) {
+            const string& word = dictionary[uniform_int_distribution<size_t>(0, dictionary.size() - 1)(generator)];
+            words.push_back(k % 2 == 0 ? word.substr(0, 1) + "*"s : word);
+            query += (query.empty() ? ""s : " "s) + words.back();
+        }
+        for (const auto& [id, text] : texts) {
+            const vector<string_view> document_words = SplitIntoWords(text);
+            const bool expected = all_of(words.begin(), words.end(), [&document_words](const string& word) {
+                return any_of(document_words.begin(), document_words.end(), [&word](string_view document_word) {
+                    return word.back() == '*' ? document_word[0] == word[0] : document_word == word;
+                    });
+                });
+            const vector<Document> found = random_server.FindTopDocuments(QueryMode::ALL_WORDS, query, [id = id](int document_id, DocumentStatus, int) {
+                return document_id == id;
+                });
+            assert(found.size() == (expected ? 1u : 0u));
+        }
+    }
+    cout << "all words prefix: OK"s << endl;
+}
+
+// Ingest and query time of the segmented index against the same server with a flush
+// threshold above the collection size, i.e. one monolithic write-optimized segment.
+void TestSegmentedIndex(const string& stop_words, const vector<string>& documents, const vector<string>& queries) {
+    for (const bool segmented : { true, false }) {
+        SearchServer search_server(stop_words);
+        if (!segmented) {
+            search_server.SetSegmentFlushThreshold(numeric_limits<size_t>::max());
+        }
+        const string mark = segmented ? "segmented"s : "monolithic"s;
+        auto start_time = chrono::steady_clock::now();
+        for (size_t i = 0; i < documents.size(); ++i) {
+            search_server.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+        }
+        search_server.WaitForMerges();
+        const double ingest_seconds = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+        start_time = chrono::steady_clock::now();
+        for (const string_view query : queries) {
+            search_server.FindTopDocuments(execution::seq, query);
+        }
+        const double query_seconds = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+        cout << mark << " index: "s << documents.size() / ingest_seconds << " documents/s ingested, "s
+            << queries.size() / query_seconds << " queries/s ("s << search_server.GetSegmentCount() << " segments)"s << endl;
+    }
+}
+
+// Every query is fanned out to all shards at once, so with enough cores throughput
+// grows with the shard count as each process scans a smaller part of the collection.
+void TestShards(size_t shard_count, const string& stop_words, const vector<string>& documents, const vector<string>& queries) {
+    ShardCoordinator coordinator(shard_count, stop_words);
+    for (size_t i = 0; i < documents.size(); ++i) {
+        coordinator.AddDocument(i, documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+    }
+    const auto start_time = chrono::steady_clock::now();
+    for (const string_view query : queries) {
+        coordinator.FindTopDocuments(query);
+    }
+    const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+    cout << shard_count << " shards: "s << queries.size() / seconds << " queries/s"s << endl;
+}
+
+// Query latency with metrics recorded against the same server with recording switched
+// off. Rounds alternate between the two, so drift in machine load hits both alike.
+void TestMetricsOverhead(string_view mark, SearchServer& search_server, const vector<string>& queries) {
+    constexpr int ROUNDS = 5;
+    double seconds_enabled = numeric_limits<double>::max();
+    double seconds_disabled = numeric_limits<double>::max();
+    for (int round = 0; round < ROUNDS; ++round) {
+        for (const bool enabled : { true, false }) {
+            search_server.EnableMetrics(enabled);
+            const auto start_time = chrono::steady_clock::now();
+            for (const string_view query : queries) {
+                search_server.FindTopDocuments(execution::seq, query);
+            }
+            const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+            double& best = enabled ? seconds_enabled : seconds_disabled;
+            best = min(best, seconds);
+        }
+    }
+    search_server.EnableMetrics(true);
+    cout << mark << " metrics overhead: "s << (seconds_enabled / seconds_disabled - 1) * 100 << "% ("s
+        << seconds_enabled * 1e6 / queries.size() << " us/query recorded, "s
+        << seconds_disabled * 1e6 / queries.size() << " us/query not)"s << endl;
+}
+
+// The document frequency exchange must make a sharded collection rank exactly like
+// one server holding all of it. Prefix words are expanded by each shard against its
+// own vocabulary, so they are checked too.
+void TestShardsMatchSingleServer(mt19937& generator, const string& stop_words, const vector<string>& dictionary,
+    const vector<string>& documents) {
+    constexpr int DOCUMENT_COUNT = 2000;
+    ShardCoordinator coordinator(3, stop_words);
+    SearchServer search_server(stop_words);
+    for (int id = 0; id < DOCUMENT_COUNT; ++id) {
+        const DocumentStatus status = id % 5 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        const vector<int> ratings{ id % 9, -(id % 4) };
+        coordinator.AddDocument(id, documents[id], status, ratings);
+        search_server.AddDocument(id, documents[id], status, ratings);
+    }
+    for (int id = 0; id < DOCUMENT_COUNT; id += 7) {
+        coordinator.RemoveDocument(id);
+        search_server.RemoveDocument(id);
+    }
+    assert(coordinator.GetDocumentCount() == search_server.GetDocumentCount());
+
+    for (int i = 0; i < 200; ++i) {
+        string query = GenerateQuery(generator, dictionary, i % 5 + 1, 0.2);
+        if (i % 2 == 0) {
+            const string& word = dictionary[uniform_int_distribution<size_t>(0, dictionary.size() - 1)(generator)];
+            query += " "s + word.substr(0, min<size_t>(word.size(), 2)) + "*"s;
+        }
+        for (const DocumentStatus status : { DocumentStatus::ACTUAL, DocumentStatus::BANNED }) {
+            const vector<Document> sharded = coordinator.FindTopDocuments(query, status);
+            const vector<Document> single = search_server.FindTopDocuments(query, status);
+            assert(equal(sharded.begin(), sharded.end(), single.begin(), single.end(), [](const Document& lhs, const Document& rhs) {
+                return lhs.id == rhs.id && lhs.rating == rhs.rating && lhs.relevance == rhs.relevance;
+                }));
+        }
+    }
+    cout << "shards match single server: OK"s << endl;
+}
+
 #define TEST(policy) Test(#policy, search_server, queries, execution::policy)
+#define TEST_ALLOCATIONS(mark, policy) TestAllocations(mark, search_server, queries, execution::policy)
+
+// Pages of one cursor must cover every match exactly once, even when documents
+// are added or removed between pages.
+void TestPaginationUnderUpdates() {
+    SearchServer search_server("and"s);
+    for (int id = 0; id < 40; ++id) {
+        search_server.AddDocument(id, "cat dog"s + string(id % 4, 'x') + " cat"s + (id % 3 ? " dog"s : ""s), DocumentStatus::ACTUAL, { id % 5 });
+    }
+    for (int id = 40; id < 50; ++id) {
+        search_server.AddDocument(id, "cat dog"s, DocumentStatus::BANNED, { 1 });
+    }
+
+    set<int> seen;
+    SearchCursor cursor;
+    for (int page_number = 0; !cursor.IsEnd(); ++page_number) {
+        SearchPage page = search_server.FindTopDocuments("cat dog"s, DocumentStatus::ACTUAL, cursor, 5);
+        for (const Document& document : page.documents) {
+            assert(document.id < 40);
+            assert(seen.insert(document.id).second);
+        }
+        cursor = page.next;
+        if (page_number == 1) {
+            search_server.AddDocument(100, "bird"s, DocumentStatus::ACTUAL, { 1 });
+        }
+        if (page_number == 3) {
+            search_server.RemoveDocument(100);
+        }
+    }
+    assert(seen.size() == 40);
+
+    // An empty page has no last document to resume after, so it is refused.
+    bool refused = false;
+    try {
+        search_server.FindTopDocuments("cat dog"s, DocumentStatus::ACTUAL, SearchCursor{}, 0);
+    }
+    catch (const invalid_argument&) {
+        refused = true;
+    }
+    assert(refused);
+    const SearchPage first = search_server.FindTopDocuments("cat dog"s, DocumentStatus::ACTUAL, SearchCursor{}, 1);
+    assert(first.documents.size() == 1 && first.documents[0].id == search_server.FindTopDocuments("cat dog"s)[0].id);
+
+    const SearchPage banned = search_server.FindTopDocuments("cat dog"s, DocumentStatus::BANNED, SearchCursor{}, 5);
+    const SearchPage actual = search_server.FindTopDocuments("cat dog"s, DocumentStatus::ACTUAL, banned.next, 5);
+    for (const Document& document : actual.documents) {
+        assert(document.id < 40);
+    }
+    cout << "pagination under updates: OK"s << endl;
+}
+
+// Runs `requests_per_thread` requests on each thread, request i finding nothing when
+// empty(i) holds, and waits for all of them.
+template <typename Queue, typename IsEmpty>
+void RunConcurrentRequests(Queue& queue, int thread_count, int requests_per_thread, IsEmpty empty) {
+    vector<thread> threads;
+    for (int t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&queue, requests_per_thread, empty] {
+            for (int i = 0; i < requests_per_thread; ++i) {
+                queue.AddFindRequest(empty(i) ? "nothing"s : "cat"s);
+            }
+            });
+    }
+    for (thread& t : threads) {
+        t.join();
+    }
+}
+
+// Each phase runs concurrently and phases are separated by joins. A phase either fits
+// in the 1440-request window or records requests of one kind only, so the window's
+// contents do not depend on how threads interleave and both queues must agree.
+void TestConcurrentRequestQueue() {
+    SearchServer search_server("and"s);
+    search_server.AddDocument(1, "cat"s, DocumentStatus::ACTUAL, { 1 });
+    ConcurrentRequestQueue concurrent_queue(search_server);
+    RequestQueue request_queue(search_server);
+    const auto run_phase = [&](int thread_count, int requests_per_thread, auto empty) {
+        RunConcurrentRequests(concurrent_queue, thread_count, requests_per_thread, empty);
+        for (int i = 0; i < thread_count * requests_per_thread; ++i) {
+            request_queue.AddFindRequest(empty(i % requests_per_thread) ? "nothing"s : "cat"s);
+        }
+        assert(concurrent_queue.GetNoResultRequests() == request_queue.GetNoResultRequests());
+    };
+    run_phase(4, 360, [](int i) { return i % 3 == 0; });
+    run_phase(4, 1000, [](int) { return true; });
+    run_phase(8, 100, [](int) { return false; });
+    run_phase(2, 1000, [](int) { return false; });
+    cout << "concurrent request queue: OK"s << endl;
+}
+
+// Recording throughput of the lock-free queue against RequestQueue behind a mutex.
+void TestRequestQueueScaling(const SearchServer& search_server) {
+    struct LockedRequestQueue {
+        RequestQueue queue;
+        mutex queue_mutex;
+
+        void AddFindRequest(const string& raw_query) {
+            lock_guard guard(queue_mutex);
+            queue.AddFindRequest(raw_query);
+        }
+    };
+    const int request_count = 1 << 14;
+    for (const int thread_count : { 1, 2, 4, 8 }) {
+        ConcurrentRequestQueue concurrent_queue(search_server);
+        LockedRequestQueue locked_queue{ RequestQueue(search_server), {} };
+        const auto empty = [](int i) { return i % 2 == 0; };
+        {
+            LOG_DURATION("concurrent request queue, "s + to_string(thread_count) + " threads"s);
+            RunConcurrentRequests(concurrent_queue, thread_count, request_count / thread_count, empty);
+        }
+        {
+            LOG_DURATION("locked request queue, "s + to_string(thread_count) + " threads"s);
+            RunConcurrentRequests(locked_queue, thread_count, request_count / thread_count, empty);
+        }
+    }
+}
+
+void TestCorpusLoaderFields() {
+    SearchServer search_server("and"s);
+    const LoadReport report = LoadCorpus(search_server, "1\tACTUAL\n2\tACTUAL\t5\n3\tACTUAL\t5\t\n4\tACTUAL\t\tcat\n"sv);
+    assert(report.documents_loaded == 2);
+    assert(report.errors.size() == 2);
+    assert(report.errors[0].line == 1 && report.errors[1].line == 2);
+    assert(search_server.FindTopDocuments("cat"s).size() == 1);
+    cout << "corpus loader fields: OK"s << endl;
+}
 
 int main() {
+    TestPaginationUnderUpdates();
+    TestCorpusLoaderFields();
+    TestConcurrentRequestQueue();
+    TestScoringKernelsIdentical();
+    TestImpactOrderingExact();
+    TestContentStoreRoundTrip();
+    TestSegmentMerges();
+    TestPrefixExpansion();
+    TestAllWordsPrefix();
+
     mt19937 generator;
 
     const auto dictionary = GenerateDictionary(generator, 1000, 10);
@@ -140,8 +854,80 @@ int main() {
 
     const auto queries = GenerateQueries(generator, dictionary, 100, 70);
 
+    // Shard processes are forked before the parallel tests start any threads.
+    TestShardsMatchSingleServer(generator, dictionary[0], dictionary, documents);
+    for (const size_t shard_count : { 1, 2, 4 }) {
+        TestShards(shard_count, dictionary[0], documents, queries);
+    }
+
+    string corpus;
+    for (size_t i = 0; i < documents.size(); ++i) {
+        corpus += to_string(i) + "\tACTUAL\t1 2 3\t"s + documents[i] + "\n"s;
+    }
+    SearchServer loaded_server(dictionary[0]);
+    cout << LoadCorpus(loaded_server, string_view(corpus));
+
     TEST(seq);
     TEST(par);
+    TestSegmentedIndex(dictionary[0], documents, queries);
+    const AutoPolicyThresholds thresholds = search_server.CalibrateAutoPolicy();
+    const auto format_threshold = [](size_t threshold, const string& unit) {
+        return threshold == numeric_limits<size_t>::max() ? "never"s : "from "s + to_string(threshold) + " "s + unit;
+    };
+    cout << "auto policy: parallel queries "s << format_threshold(thresholds.query_postings, "postings"s)
+        << ", parallel matches "s << format_threshold(thresholds.words, "words"s) << endl;
+    Test("auto"s, search_server, queries, auto_policy);
+    Test("short auto"s, search_server, GenerateQueries(generator, dictionary, 100, 2), auto_policy);
+
+    vector<string> prefix_queries;
+    for (const string& query : GenerateQueries(generator, dictionary, 100, 3)) {
+        string prefix_query;
+        for (const string_view word : SplitIntoWords(query)) {
+            prefix_query += (prefix_query.empty() ? ""s : " "s) + string(word.substr(0, 1)) + "*"s;
+        }
+        prefix_queries.push_back(move(prefix_query));
+    }
+    Test("prefix seq"s, search_server, prefix_queries, execution::seq);
+
+    QueryArena::SetEnabled(false);
+    TEST_ALLOCATIONS("heap seq"s, seq);
+    TEST_ALLOCATIONS("heap par"s, par);
+    QueryArena::SetEnabled(true);
+    TEST_ALLOCATIONS("arena seq"s, seq);
+    TEST_ALLOCATIONS("arena par"s, par);
+
+    SearchServer zipf_server(dictionary[0]);
+    const auto zipf_documents = GenerateZipfQueries(generator, dictionary, 1000'0, 70);
+    for (size_t i = 0; i < zipf_documents.size(); ++i) {
+        zipf_server.AddDocument(i, zipf_documents[i], DocumentStatus::ACTUAL, { 1, 2, 3 });
+    }
+    const auto zipf_queries = GenerateZipfQueries(generator, dictionary, 100, 5);
+    Test("zipf seq"s, zipf_server, zipf_queries, execution::seq);
+    Test("zipf par"s, zipf_server, zipf_queries, execution::par);
+    Test("zipf all words"s, zipf_server, zipf_queries, QueryMode::ALL_WORDS);
+
+    TestScoring(generator);
+    TestRequestQueueScaling(search_server);
+
+    const auto short_queries = GenerateZipfQueries(generator, dictionary, 100, 2);
+    Test("short seq"s, zipf_server, short_queries, execution::seq);
+    TestMetricsOverhead("long"s, search_server, queries);
+    TestMetricsOverhead("short"s, zipf_server, short_queries);
+    zipf_server.EnableImpactOrdering(true);
+    Test("short impact"s, zipf_server, short_queries, execution::seq);
+
+    {
+        constexpr int FETCH_COUNT = 10000;
+        size_t content_bytes = 0;
+        const auto start_time = chrono::steady_clock::now();
+        for (int i = 0; i < FETCH_COUNT; ++i) {
+            content_bytes += search_server.GetDocumentContent(generator() % documents.size()).size();
+        }
+        const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+        cout << "content fetch: "s << FETCH_COUNT / seconds << " documents/s, "s << content_bytes / seconds / 1e6 << " MB/s"s << endl;
+    }
 
+    cout << search_server.GetMetrics();
+    cout << search_server.GetMemoryUsage();
 }
 #endif 
\ No newline at end of file
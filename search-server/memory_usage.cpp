@@ -0,0 +1,51 @@
+#include "memory_usage.h"
+
+#include <numeric>
+#include <string>
+
+using namespace std;
+
+namespace {
+
+const char* CategoryName(MemoryCategory category) {
+    switch (category) {
+    case MemoryCategory::DOCUMENT_CONTENT: return "document_content";
+    case MemoryCategory::POSTINGS: return "postings";
+    case MemoryCategory::WORD_FREQS: return "word_freqs";
+    case MemoryCategory::DOCUMENT_TABLE: return "document_table";
+    case MemoryCategory::TERM_DICTIONARY: return "term_dictionary";
+    case MemoryCategory::STOP_WORDS: return "stop_words";
+    case MemoryCategory::SCORE_ACCUMULATORS: return "score_accumulators";
+    }
+    return "unknown";
+}
+
+} // namespace
+
+void* CountingResource::do_allocate(size_t bytes, size_t alignment) {
+    void* p = upstream_->allocate(bytes, alignment);
+    bytes_.fetch_add(bytes, memory_order_relaxed);
+    return p;
+}
+
+void CountingResource::do_deallocate(void* p, size_t bytes, size_t alignment) {
+    upstream_->deallocate(p, bytes, alignment);
+    bytes_.fetch_sub(bytes, memory_order_relaxed);
+}
+
+bool CountingResource::do_is_equal(const pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
+
+size_t MemoryUsage::GetTotalBytes() const {
+    return accumulate(bytes.begin(), bytes.end(), size_t{ 0 });
+}
+
+ostream& operator<<(ostream& out, const MemoryUsage& usage) {
+    for (size_t i = 0; i < MEMORY_CATEGORY_COUNT; ++i) {
+        out << CategoryName(static_cast<MemoryCategory>(i)) << " = "s << usage.bytes[i] << " bytes"s << endl;
+    }
+    out << "total = "s << usage.GetTotalBytes() << " bytes"s << endl;
+    out << "dead ordinals = "s << usage.dead_ordinals << endl;
+    return out;
+}
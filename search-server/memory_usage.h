@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <iostream>
+#include <limits>
+#include <memory_resource>
+
+enum class MemoryCategory {
+    // Resident part of the document text store: the block being filled, the cache of
+    // decompressed blocks and the location index.
+    DOCUMENT_CONTENT,
+    // Segments, the mutable segment and impact-ordered postings.
+    POSTINGS,
+    // Per-document word -> term frequency maps.
+    WORD_FREQS,
+    // Ids, ordinals, ratings, statuses and liveness of every document.
+    DOCUMENT_TABLE,
+    // Interned terms and their document frequencies.
+    TERM_DICTIONARY,
+    STOP_WORDS,
+    // Dense score arrays pooled for query scans.
+    SCORE_ACCUMULATORS,
+};
+
+constexpr size_t MEMORY_CATEGORY_COUNT = static_cast<size_t>(MemoryCategory::SCORE_ACCUMULATORS) + 1;
+constexpr size_t UNLIMITED_MEMORY = std::numeric_limits<size_t>::max();
+
+enum class MemoryBudgetPolicy {
+    // Documents that would exceed the budget are refused.
+    REJECT,
+    // Resident document text is written out to the content store's file and dropped
+    // from memory to make room first, but only when that frees enough; otherwise the
+    // document is refused as with REJECT. No document is lost.
+    EVICT_CONTENT,
+};
+
+// Passes every request to the upstream resource and keeps a running total of the
+// bytes currently allocated. Thread-safe whenever the upstream is.
+class CountingResource : public std::pmr::memory_resource {
+public:
+    explicit CountingResource(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+        : upstream_(upstream) {
+    }
+
+    size_t GetBytes() const {
+        return bytes_.load(std::memory_order_relaxed);
+    }
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+    std::pmr::memory_resource* upstream_;
+    std::atomic<size_t> bytes_{ 0 };
+};
+
+// Heap bytes held by a SearchServer, by category. Allocator bookkeeping and the
+// server object itself are not included.
+struct MemoryUsage {
+    std::array<size_t, MEMORY_CATEGORY_COUNT> bytes{};
+    // Ordinal slots still held by removed documents; each keeps its column entries.
+    size_t dead_ordinals = 0;
+
+    size_t Bytes(MemoryCategory category) const {
+        return bytes[static_cast<size_t>(category)];
+    }
+
+    size_t GetTotalBytes() const;
+};
+
+std::ostream& operator<<(std::ostream& out, const MemoryUsage& usage);
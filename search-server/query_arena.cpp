@@ -0,0 +1,113 @@
+#include "query_arena.h"
+
+#include <algorithm>
+#include <atomic>
+#include <optional>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+constexpr size_t INITIAL_ARENA_SIZE = 64 * 1024;
+constexpr size_t MAX_ARENA_SIZE = 16 * 1024 * 1024;
+
+atomic<bool> arena_enabled{ true };
+
+// Forwards to the heap and remembers how much the arena had to borrow beyond its buffer.
+class OverflowCounter : public pmr::memory_resource {
+public:
+    size_t TakeOverflow() {
+        return exchange(overflow_, 0);
+    }
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        overflow_ += bytes;
+        return pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    size_t overflow_ = 0;
+};
+
+class ThreadArena {
+public:
+    pmr::memory_resource* Enter() {
+        if (depth_++ == 0 && !resource_) {
+            Rebuild(INITIAL_ARENA_SIZE);
+        }
+        return &*resource_;
+    }
+
+    void Leave() {
+        if (--depth_ > 0) {
+            return;
+        }
+        resource_->release();
+        const size_t overflow = upstream_.TakeOverflow();
+        if (overflow > 0 && buffer_.size() < MAX_ARENA_SIZE) {
+            Rebuild(min(MAX_ARENA_SIZE, buffer_.size() + overflow));
+        }
+    }
+
+private:
+    void Rebuild(size_t size) {
+        resource_.reset();
+        buffer_.assign(size, byte{ 0 });
+        resource_.emplace(buffer_.data(), buffer_.size(), &upstream_);
+    }
+
+    OverflowCounter upstream_;
+    vector<byte> buffer_;
+    optional<pmr::monotonic_buffer_resource> resource_;
+    int depth_ = 0;
+};
+
+thread_local ThreadArena thread_arena;
+
+} // namespace
+
+QueryArena::Scope::Scope()
+    : resource_(pmr::new_delete_resource())
+    , entered_(arena_enabled.load(memory_order_relaxed)) {
+    if (entered_) {
+        resource_ = thread_arena.Enter();
+    }
+}
+
+QueryArena::Scope::~Scope() {
+    if (entered_) {
+        thread_arena.Leave();
+    }
+}
+
+void QueryArena::SetEnabled(bool enabled) {
+    arena_enabled.store(enabled, memory_order_relaxed);
+}
+
+bool QueryArena::IsEnabled() {
+    return arena_enabled.load(memory_order_relaxed);
+}
+
+void* SynchronizedResource::do_allocate(size_t bytes, size_t alignment) {
+    lock_guard guard(mutex_);
+    return upstream_->allocate(bytes, alignment);
+}
+
+void SynchronizedResource::do_deallocate(void* p, size_t bytes, size_t alignment) {
+    lock_guard guard(mutex_);
+    upstream_->deallocate(p, bytes, alignment);
+}
+
+bool SynchronizedResource::do_is_equal(const pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
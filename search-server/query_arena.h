@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+
+// Per-thread monotonic arena for the temporaries of one query. Opening a Scope
+// hands out the calling thread's arena; nested scopes share it and everything is
+// released in O(1) when the outermost scope closes. The arena keeps its buffer
+// between queries and grows it to the largest query seen, so a warmed-up thread
+// does not touch the heap for query temporaries at all.
+class QueryArena {
+public:
+    class Scope {
+    public:
+        Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+        ~Scope();
+
+        std::pmr::memory_resource* Resource() const {
+            return resource_;
+        }
+
+    private:
+        std::pmr::memory_resource* resource_;
+        bool entered_;
+    };
+
+    // With the arena disabled, scopes hand out the global heap; used to compare both.
+    static void SetEnabled(bool enabled);
+    static bool IsEnabled();
+};
+
+// Lets several threads carve memory out of one (non thread-safe) upstream resource.
+class SynchronizedResource : public std::pmr::memory_resource {
+public:
+    explicit SynchronizedResource(std::pmr::memory_resource* upstream)
+        : upstream_(upstream) {
+    }
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+    std::pmr::memory_resource* upstream_;
+    std::mutex mutex_;
+};
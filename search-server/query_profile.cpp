@@ -0,0 +1,27 @@
+#include "query_profile.h"
+
+using namespace std;
+
+ostream& operator<<(ostream& out, const QueryProfile& profile) {
+    out << "{ parse = "s << profile.parse_time.count() << " ns, "s
+        << "scan = "s << profile.scan_time.count() << " ns, "s
+        << "minus = "s << profile.minus_time.count() << " ns, "s
+        << "top_k = "s << profile.top_k_time.count() << " ns, "s
+        << "total = "s << profile.total_time.count() << " ns, "s
+        << "predicate_passed = "s << profile.predicate_passed << ", "s
+        << "predicate_rejected = "s << profile.predicate_rejected << ", "s
+        << "documents_dead = "s << profile.documents_dead << ", "s
+        << "documents_scored = "s << profile.documents_scored << ", "s
+        << "minus_eliminated = "s << profile.minus_eliminated << " }"s << endl;
+    for (const TermProfile& term : profile.terms) {
+        out << "  "s << (term.is_minus ? "-"s : ""s) << term.word << ": "s
+            << "postings = "s << term.posting_length << ", "s
+            << "idf = "s << term.inverse_document_freq << ", "s
+            << "passed = "s << term.predicate_passed << ", "s
+            << "rejected = "s << term.predicate_rejected << ", "s
+            << "dead = "s << term.documents_dead << ", "s
+            << "eliminated = "s << term.documents_eliminated << ", "s
+            << "time = "s << term.elapsed.count() << " ns"s << endl;
+    }
+    return out;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "document.h"
+
+struct TermProfile {
+    std::string word;
+    bool is_minus = false;
+    size_t posting_length = 0;
+    double inverse_document_freq = 0.0;
+    // Candidate documents first reached through this term, each counted once.
+    // Dead ones were removed but still have postings in a segment.
+    size_t predicate_passed = 0;
+    size_t predicate_rejected = 0;
+    size_t documents_dead = 0;
+    size_t documents_eliminated = 0;
+    std::chrono::nanoseconds elapsed{ 0 };
+};
+
+struct QueryProfile {
+    std::vector<TermProfile> terms;
+    size_t predicate_passed = 0;
+    size_t predicate_rejected = 0;
+    size_t documents_dead = 0;
+    size_t documents_scored = 0;
+    size_t minus_eliminated = 0;
+    std::chrono::nanoseconds parse_time{ 0 };
+    std::chrono::nanoseconds scan_time{ 0 };
+    std::chrono::nanoseconds minus_time{ 0 };
+    std::chrono::nanoseconds top_k_time{ 0 };
+    std::chrono::nanoseconds total_time{ 0 };
+
+    TermProfile& AddTerm(std::string_view word, bool is_minus) {
+        TermProfile& term = terms.emplace_back();
+        term.word = std::string(word);
+        term.is_minus = is_minus;
+        return term;
+    }
+
+    void FinishScan(size_t matched_count) {
+        for (const TermProfile& term : terms) {
+            predicate_passed += term.predicate_passed;
+            predicate_rejected += term.predicate_rejected;
+            documents_dead += term.documents_dead;
+            minus_eliminated += term.documents_eliminated;
+        }
+        documents_scored = matched_count + minus_eliminated;
+    }
+};
+
+struct ProfiledDocuments {
+    std::vector<Document> documents;
+    QueryProfile profile;
+};
+
+// Times a single query term; costs one branch when profiling is off.
+class TermTimer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit TermTimer(TermProfile* term)
+        : term_(term), start_time_(term ? Clock::now() : Clock::time_point{}) {
+    }
+
+    TermTimer(const TermTimer&) = delete;
+    TermTimer& operator=(const TermTimer&) = delete;
+
+    ~TermTimer() {
+        if (term_) {
+            term_->elapsed += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_time_);
+        }
+    }
+
+private:
+    TermProfile* const term_;
+    const Clock::time_point start_time_;
+};
+
+std::ostream& operator<<(std::ostream& out, const QueryProfile& profile);
@@ -0,0 +1,266 @@
+#include "scoring_kernel.h"
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCORING_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+// A fused multiply-add rounds once where the scalar ranking rounds twice; keep the
+// products and sums separate so double mode stays bit-identical.
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+using namespace std;
+
+namespace {
+
+// Scores live at scores[ordinal - base]; ordinals of one block are distinct, so the
+// vector kernels can gather and write back without conflicts.
+template <typename Score>
+void ScoreScalar(const int* ordinals, const double* term_freqs, const uint8_t* mask, size_t count,
+    Score inverse_document_freq, Score* scores, int base) {
+    for (size_t i = 0; i < count; ++i) {
+        if (mask[i]) {
+            scores[ordinals[i] - base] += static_cast<Score>(term_freqs[i]) * inverse_document_freq;
+        }
+    }
+}
+
+#ifdef SCORING_KERNEL_X86
+// GCC 12 warns about the deliberately undefined pass-through operands inside its
+// own AVX-512 intrinsics.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx2")))
+void ScoreAvx2(const int* ordinals, const double* term_freqs, const uint8_t* mask, size_t count,
+    double inverse_document_freq, double* scores, int base) {
+    const __m256d idf = _mm256_set1_pd(inverse_document_freq);
+    const __m128i base_vector = _mm_set1_epi32(base);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        int32_t mask_bytes;
+        __builtin_memcpy(&mask_bytes, mask + i, sizeof(mask_bytes));
+        if (mask_bytes == 0) {
+            continue;
+        }
+        const __m128i index = _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ordinals + i)), base_vector);
+        const __m256d lanes = _mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_cvtepu8_epi64(_mm_cvtsi32_si128(mask_bytes)), _mm256_setzero_si256()));
+        const __m256d current = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), scores, index, lanes, 8);
+        alignas(32) double sums[4];
+        _mm256_store_pd(sums, _mm256_add_pd(current, _mm256_mul_pd(_mm256_loadu_pd(term_freqs + i), idf)));
+        for (size_t lane = 0; lane < 4; ++lane) {
+            if (mask[i + lane]) {
+                scores[ordinals[i + lane] - base] = sums[lane];
+            }
+        }
+    }
+    ScoreScalar(ordinals + i, term_freqs + i, mask + i, count - i, inverse_document_freq, scores, base);
+}
+
+__attribute__((target("avx2")))
+void ScoreAvx2(const int* ordinals, const double* term_freqs, const uint8_t* mask, size_t count,
+    float inverse_document_freq, float* scores, int base) {
+    const __m256 idf = _mm256_set1_ps(inverse_document_freq);
+    const __m256i base_vector = _mm256_set1_epi32(base);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int64_t mask_bytes;
+        __builtin_memcpy(&mask_bytes, mask + i, sizeof(mask_bytes));
+        if (mask_bytes == 0) {
+            continue;
+        }
+        const __m256i index = _mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ordinals + i)), base_vector);
+        const __m256 lanes = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_cvtepu8_epi32(_mm_cvtsi64_si128(mask_bytes)), _mm256_setzero_si256()));
+        const __m256 term_freq = _mm256_set_m128(_mm256_cvtpd_ps(_mm256_loadu_pd(term_freqs + i + 4)), _mm256_cvtpd_ps(_mm256_loadu_pd(term_freqs + i)));
+        const __m256 current = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), scores, index, lanes, 4);
+        alignas(32) float sums[8];
+        _mm256_store_ps(sums, _mm256_add_ps(current, _mm256_mul_ps(term_freq, idf)));
+        for (size_t lane = 0; lane < 8; ++lane) {
+            if (mask[i + lane]) {
+                scores[ordinals[i + lane] - base] = sums[lane];
+            }
+        }
+    }
+    ScoreScalar(ordinals + i, term_freqs + i, mask + i, count - i, inverse_document_freq, scores, base);
+}
+
+__attribute__((target("avx512f")))
+void ScoreAvx512(const int* ordinals, const double* term_freqs, const uint8_t* mask, size_t count,
+    double inverse_document_freq, double* scores, int base) {
+    const __m512d idf = _mm512_set1_pd(inverse_document_freq);
+    const __m256i base_vector = _mm256_set1_epi32(base);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m512i mask_lanes = _mm512_cvtepu8_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(mask + i)));
+        const __mmask8 lanes = _mm512_test_epi64_mask(mask_lanes, mask_lanes);
+        if (lanes == 0) {
+            continue;
+        }
+        const __m256i index = _mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ordinals + i)), base_vector);
+        const __m512d current = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), lanes, index, scores, 8);
+        const __m512d sum = _mm512_add_pd(current, _mm512_mul_pd(_mm512_loadu_pd(term_freqs + i), idf));
+        _mm512_mask_i32scatter_pd(scores, lanes, index, sum, 8);
+    }
+    ScoreScalar(ordinals + i, term_freqs + i, mask + i, count - i, inverse_document_freq, scores, base);
+}
+
+__attribute__((target("avx512f")))
+void ScoreAvx512(const int* ordinals, const double* term_freqs, const uint8_t* mask, size_t count,
+    float inverse_document_freq, float* scores, int base) {
+    const __m512 idf = _mm512_set1_ps(inverse_document_freq);
+    const __m512i base_vector = _mm512_set1_epi32(base);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m512i mask_lanes = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + i)));
+        const __mmask16 lanes = _mm512_test_epi32_mask(mask_lanes, mask_lanes);
+        if (lanes == 0) {
+            continue;
+        }
+        const __m512i index = _mm512_sub_epi32(_mm512_loadu_si512(ordinals + i), base_vector);
+        const __m256 low = _mm512_cvtpd_ps(_mm512_loadu_pd(term_freqs + i));
+        const __m256 high = _mm512_cvtpd_ps(_mm512_loadu_pd(term_freqs + i + 8));
+        const __m512 term_freq = _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castpd256_pd512(_mm256_castps_pd(low)), _mm256_castps_pd(high), 1));
+        const __m512 current = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), lanes, index, scores, 4);
+        const __m512 sum = _mm512_add_ps(current, _mm512_mul_ps(term_freq, idf));
+        _mm512_mask_i32scatter_ps(scores, lanes, index, sum, 4);
+    }
+    ScoreScalar(ordinals + i, term_freqs + i, mask + i, count - i, inverse_document_freq, scores, base);
+}
+
+#pragma GCC diagnostic pop
+#endif
+
+bool CpuSupports(ScoringKernel kernel) {
+#ifdef SCORING_KERNEL_X86
+    switch (kernel) {
+    case ScoringKernel::AVX512:
+        return __builtin_cpu_supports("avx512f");
+    case ScoringKernel::AVX2:
+        return __builtin_cpu_supports("avx2");
+    default:
+        return true;
+    }
+#else
+    return kernel == ScoringKernel::SCALAR;
+#endif
+}
+
+// AVX2 has no scatter, so every accepted lane is written back one at a time; that
+// measures no faster than the scalar loop, and often slower, so the kernel is only
+// used when selected explicitly.
+ScoringKernel DetectScoringKernel() {
+    return CpuSupports(ScoringKernel::AVX512) ? ScoringKernel::AVX512 : ScoringKernel::SCALAR;
+}
+
+atomic<ScoringKernel> active_kernel{ DetectScoringKernel() };
+
+template <typename Score>
+void ScorePostings(const int* ordinals, const double* term_freqs, const uint8_t* mask, size_t count,
+    Score inverse_document_freq, Score* scores, int base) {
+    switch (active_kernel.load(memory_order_relaxed)) {
+#ifdef SCORING_KERNEL_X86
+    case ScoringKernel::AVX512:
+        ScoreAvx512(ordinals, term_freqs, mask, count, inverse_document_freq, scores, base);
+        return;
+    case ScoringKernel::AVX2:
+        ScoreAvx2(ordinals, term_freqs, mask, count, inverse_document_freq, scores, base);
+        return;
+#endif
+    default:
+        ScoreScalar(ordinals, term_freqs, mask, count, inverse_document_freq, scores, base);
+    }
+}
+
+} // namespace
+
+ScoringKernel GetScoringKernel() {
+    return active_kernel.load(memory_order_relaxed);
+}
+
+bool IsScoringKernelSupported(ScoringKernel kernel) {
+    return CpuSupports(kernel);
+}
+
+void SetScoringKernel(ScoringKernel kernel) {
+    if (!IsScoringKernelSupported(kernel)) {
+        throw invalid_argument("Scoring kernel "s + string(GetScoringKernelName(kernel)) + " is not supported by this CPU"s);
+    }
+    active_kernel.store(kernel, memory_order_relaxed);
+}
+
+string_view GetScoringKernelName(ScoringKernel kernel) {
+    switch (kernel) {
+    case ScoringKernel::AVX512:
+        return "avx512"sv;
+    case ScoringKernel::AVX2:
+        return "avx2"sv;
+    default:
+        return "scalar"sv;
+    }
+}
+
+
+void ScoreAccumulator::Start(int first_ordinal, int end_ordinal, ScoringPrecision precision) {
+    const size_t size = end_ordinal - first_ordinal;
+    first_ordinal_ = first_ordinal;
+    precision_ = precision;
+    accepted_ordinals_.clear();
+    if (++generation_ == 0 || stamps_.size() < size) {
+        // Fresh (or wrapped-around) stamps: no entry may look current.
+        stamps_.assign(max(size, stamps_.size()), 0);
+        accepted_.resize(stamps_.size());
+        generation_ = 1;
+    }
+    if (precision == ScoringPrecision::DOUBLE && double_scores_.size() < size) {
+        double_scores_.resize(stamps_.size());
+    }
+    if (precision == ScoringPrecision::FLOAT && float_scores_.size() < size) {
+        float_scores_.resize(stamps_.size());
+    }
+}
+
+void ScoreAccumulator::Accept(int ordinal) {
+    const size_t index = ordinal - first_ordinal_;
+    accepted_[index] = 1;
+    if (precision_ == ScoringPrecision::DOUBLE) {
+        double_scores_[index] = 0.0;
+    }
+    else {
+        float_scores_[index] = 0.0f;
+    }
+    accepted_ordinals_.push_back(ordinal);
+}
+
+ScoreAccumulatorPool::Lease ScoreAccumulatorPool::Acquire() {
+    {
+        lock_guard guard(mutex_);
+        if (!free_.empty()) {
+            auto accumulator = move(free_.back());
+            free_.pop_back();
+            return Lease(*this, move(accumulator));
+        }
+    }
+    return Lease(*this, make_unique<ScoreAccumulator>(resource_));
+}
+
+void ScoreAccumulatorPool::Release(unique_ptr<ScoreAccumulator> accumulator) {
+    lock_guard guard(mutex_);
+    free_.push_back(move(accumulator));
+}
+
+void ScoreAccumulator::ScoreBlock(const int* ordinals, const double* term_freqs, const uint8_t* mask, size_t count, double inverse_document_freq) {
+    if (precision_ == ScoringPrecision::DOUBLE) {
+        ScorePostings(ordinals, term_freqs, mask, count, inverse_document_freq, double_scores_.data(), first_ordinal_);
+    }
+    else {
+        ScorePostings(ordinals, term_freqs, mask, count, static_cast<float>(inverse_document_freq), float_scores_.data(), first_ordinal_);
+    }
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+enum class ScoringPrecision {
+    // Same products and additions, in the same order, as scoring one posting at a
+    // time, so relevance is bit-identical to the scalar ranking.
+    DOUBLE,
+    // Twice the lanes per instruction; relevance differs in the last few digits.
+    FLOAT,
+};
+
+enum class ScoringKernel {
+    SCALAR,
+    AVX2,
+    AVX512,
+};
+
+// AVX512 is picked at startup when the CPU has it and SCALAR otherwise; AVX2 is
+// slower than SCALAR and only runs when selected. SetScoringKernel switches kernels
+// (for comparison) and throws invalid_argument if the CPU cannot run the requested one.
+ScoringKernel GetScoringKernel();
+void SetScoringKernel(ScoringKernel kernel);
+bool IsScoringKernelSupported(ScoringKernel kernel);
+std::string_view GetScoringKernelName(ScoringKernel kernel);
+
+// Dense scores for a range of ordinals, used by one scan at a time. An entry is only
+// valid when its stamp equals the current generation, so starting a query costs O(1)
+// instead of clearing the arrays. A document is visited once per query: the first
+// posting that reaches it decides whether it is accepted (alive and passing the
+// predicate).
+class ScoreAccumulator {
+public:
+    explicit ScoreAccumulator(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : stamps_(resource)
+        , accepted_(resource)
+        , double_scores_(resource)
+        , float_scores_(resource)
+        , accepted_ordinals_(resource) {
+    }
+
+    void Start(int first_ordinal, int end_ordinal, ScoringPrecision precision);
+
+    // Returns true the first time the ordinal is seen in this query.
+    bool Visit(int ordinal) {
+        uint32_t& stamp = stamps_[ordinal - first_ordinal_];
+        if (stamp == generation_) {
+            return false;
+        }
+        stamp = generation_;
+        accepted_[ordinal - first_ordinal_] = 0;
+        return true;
+    }
+
+    void Accept(int ordinal);
+
+    bool IsAccepted(int ordinal) const {
+        const size_t index = ordinal - first_ordinal_;
+        return stamps_[index] == generation_ && accepted_[index];
+    }
+
+    // Drops an accepted document; returns whether it was accepted.
+    bool Discard(int ordinal) {
+        if (!IsAccepted(ordinal)) {
+            return false;
+        }
+        accepted_[ordinal - first_ordinal_] = 0;
+        return true;
+    }
+
+    // mask[i] is the acceptance of ordinals[i]; accepted postings add term_freq * idf.
+    void ScoreBlock(const int* ordinals, const double* term_freqs, const uint8_t* mask, size_t count, double inverse_document_freq);
+
+    size_t GetAcceptedCount() const {
+        return accepted_ordinals_.size();
+    }
+
+    // Accepted documents in ordinal order.
+    template <typename Func>
+    void ForEachAccepted(Func func);
+
+private:
+    int first_ordinal_ = 0;
+    uint32_t generation_ = 0;
+    ScoringPrecision precision_ = ScoringPrecision::DOUBLE;
+    std::pmr::vector<uint32_t> stamps_;
+    std::pmr::vector<uint8_t> accepted_;
+    std::pmr::vector<double> double_scores_;
+    std::pmr::vector<float> float_scores_;
+    std::pmr::vector<int> accepted_ordinals_;
+};
+
+// Accumulators kept between queries. Parallel workers run on fresh threads, so
+// per-thread accumulators would be reallocated by every query; leased ones have
+// already grown to the collection and are only ever reused.
+class ScoreAccumulatorPool {
+public:
+    class Lease {
+    public:
+        Lease(ScoreAccumulatorPool& pool, std::unique_ptr<ScoreAccumulator> accumulator)
+            : pool_(pool), accumulator_(std::move(accumulator)) {
+        }
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        ~Lease() {
+            pool_.Release(std::move(accumulator_));
+        }
+
+        ScoreAccumulator& operator*() const {
+            return *accumulator_;
+        }
+
+    private:
+        ScoreAccumulatorPool& pool_;
+        std::unique_ptr<ScoreAccumulator> accumulator_;
+    };
+
+    explicit ScoreAccumulatorPool(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : resource_(resource) {
+    }
+
+    Lease Acquire();
+
+private:
+    void Release(std::unique_ptr<ScoreAccumulator> accumulator);
+
+    std::pmr::memory_resource* resource_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<ScoreAccumulator>> free_;
+};
+
+template <typename Func>
+void ScoreAccumulator::ForEachAccepted(Func func) {
+    std::sort(accepted_ordinals_.begin(), accepted_ordinals_.end());
+    for (const int ordinal : accepted_ordinals_) {
+        const size_t index = ordinal - first_ordinal_;
+        if (accepted_[index]) {
+            func(ordinal, precision_ == ScoringPrecision::DOUBLE ? double_scores_[index] : static_cast<double>(float_scores_[index]));
+        }
+    }
+}
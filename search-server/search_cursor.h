@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "document.h"
+
+class SearchServer;
+
+// Opaque search-after position. A default cursor asks for the first page; every
+// page returns the cursor for the next one.
+class SearchCursor {
+public:
+    SearchCursor() = default;
+
+    bool IsStart() const {
+        return !started_;
+    }
+
+    bool IsEnd() const {
+        return exhausted_;
+    }
+
+private:
+    friend class SearchServer;
+
+    double relevance_ = 0.0;
+    int rating_ = 0;
+    int document_id_ = 0;
+    uint64_t cache_token_ = 0;
+    size_t offset_ = 0;
+    bool started_ = false;
+    bool exhausted_ = false;
+};
+
+struct SearchPage {
+    std::vector<Document> documents;
+    SearchCursor next;
+};
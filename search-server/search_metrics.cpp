@@ -0,0 +1,165 @@
+#include "search_metrics.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+int HighestBit(uint64_t value) {
+    int bit = 0;
+    while (value >>= 1) {
+        ++bit;
+    }
+    return bit;
+}
+
+const char* StageName(SearchStage stage) {
+    switch (stage) {
+    case SearchStage::PARSE: return "parse";
+    case SearchStage::POSTING_SCAN: return "posting_scan";
+    case SearchStage::MINUS_FILTER: return "minus_filter";
+    case SearchStage::TOP_K: return "top_k";
+    case SearchStage::QUERY: return "query";
+    case SearchStage::ADD_DOCUMENT: return "add_document";
+    case SearchStage::REMOVE_DOCUMENT: return "remove_document";
+    }
+    return "unknown";
+}
+
+const char* CounterName(SearchCounter counter) {
+    switch (counter) {
+    case SearchCounter::QUERIES: return "queries";
+    case SearchCounter::POSTINGS_SCANNED: return "postings_scanned";
+    case SearchCounter::DOCUMENTS_SCORED: return "documents_scored";
+    case SearchCounter::DOCUMENTS_ADDED: return "documents_added";
+    case SearchCounter::DOCUMENTS_REMOVED: return "documents_removed";
+    case SearchCounter::CONTENTS_EVICTED: return "contents_evicted";
+    }
+    return "unknown";
+}
+
+void PrintHistogram(ostream& out, const char* name, const HistogramSnapshot& histogram) {
+    out << name << ": count = "s << histogram.count
+        << ", mean = "s << histogram.Mean()
+        << ", p50 = "s << histogram.Percentile(50)
+        << ", p99 = "s << histogram.Percentile(99)
+        << ", max = "s << histogram.Max() << endl;
+}
+
+} // namespace
+
+size_t LatencyHistogram::BucketIndex(uint64_t value) noexcept {
+    if (value < SUB_BUCKET_COUNT) {
+        return static_cast<size_t>(value);
+    }
+    const int shift = min(HighestBit(value) - SUB_BUCKET_BITS, MAX_SHIFT);
+    const uint64_t sub_bucket = min((value >> shift) - SUB_BUCKET_COUNT, SUB_BUCKET_COUNT - 1);
+    return static_cast<size_t>(SUB_BUCKET_COUNT * (shift + 1) + sub_bucket);
+}
+
+uint64_t LatencyHistogram::BucketLowerBound(size_t index) noexcept {
+    if (index < SUB_BUCKET_COUNT) {
+        return index;
+    }
+    const int shift = static_cast<int>(index / SUB_BUCKET_COUNT) - 1;
+    const uint64_t sub_bucket = index % SUB_BUCKET_COUNT;
+    return (SUB_BUCKET_COUNT + sub_bucket) << shift;
+}
+
+void LatencyHistogram::AddTo(vector<uint64_t>& buckets, uint64_t& sum) const {
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        buckets[i] += buckets_[i].load(memory_order_relaxed);
+    }
+    sum += sum_.load(memory_order_relaxed);
+}
+
+double HistogramSnapshot::Mean() const {
+    return count == 0 ? 0.0 : static_cast<double>(sum) / count;
+}
+
+uint64_t HistogramSnapshot::Percentile(double percent) const {
+    if (count == 0) {
+        return 0;
+    }
+    const uint64_t rank = max<uint64_t>(1, static_cast<uint64_t>(count * percent / 100.0 + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return LatencyHistogram::BucketLowerBound(i);
+        }
+    }
+    return Max();
+}
+
+uint64_t HistogramSnapshot::Max() const {
+    for (size_t i = buckets.size(); i > 0; --i) {
+        if (buckets[i - 1] != 0) {
+            return LatencyHistogram::BucketLowerBound(i - 1);
+        }
+    }
+    return 0;
+}
+
+ostream& operator<<(ostream& out, const MetricsSnapshot& snapshot) {
+    for (size_t i = 0; i < SEARCH_STAGE_COUNT; ++i) {
+        PrintHistogram(out, StageName(static_cast<SearchStage>(i)), snapshot.stage_latency_ns[i]);
+    }
+    PrintHistogram(out, "postings_per_query", snapshot.postings_per_query);
+    PrintHistogram(out, "documents_scored_per_query", snapshot.documents_scored_per_query);
+    for (size_t i = 0; i < SEARCH_COUNTER_COUNT; ++i) {
+        out << CounterName(static_cast<SearchCounter>(i)) << " = "s << snapshot.counters[i] << endl;
+    }
+    return out;
+}
+
+SearchMetrics::SearchMetrics()
+    : shards_(make_unique<Shard[]>(SHARD_COUNT)) {
+}
+
+size_t SearchMetrics::ThreadShardIndex() noexcept {
+    static atomic<size_t> next_index{ 0 };
+    thread_local const size_t index = next_index.fetch_add(1, memory_order_relaxed) % SHARD_COUNT;
+    return index;
+}
+
+void SearchMetrics::RecordQuery(uint64_t postings_scanned, uint64_t documents_scored) noexcept {
+    if (!IsEnabled()) {
+        return;
+    }
+    Shard& shard = LocalShard();
+    shard.counters[static_cast<size_t>(SearchCounter::QUERIES)].fetch_add(1, memory_order_relaxed);
+    shard.counters[static_cast<size_t>(SearchCounter::POSTINGS_SCANNED)].fetch_add(postings_scanned, memory_order_relaxed);
+    shard.counters[static_cast<size_t>(SearchCounter::DOCUMENTS_SCORED)].fetch_add(documents_scored, memory_order_relaxed);
+    shard.postings_per_query.Record(postings_scanned);
+    shard.documents_scored_per_query.Record(documents_scored);
+}
+
+MetricsSnapshot SearchMetrics::GetSnapshot() const {
+    MetricsSnapshot snapshot;
+    for (size_t s = 0; s < SHARD_COUNT; ++s) {
+        const Shard& shard = shards_[s];
+        for (size_t i = 0; i < SEARCH_STAGE_COUNT; ++i) {
+            shard.stage_latency[i].AddTo(snapshot.stage_latency_ns[i].buckets, snapshot.stage_latency_ns[i].sum);
+        }
+        shard.postings_per_query.AddTo(snapshot.postings_per_query.buckets, snapshot.postings_per_query.sum);
+        shard.documents_scored_per_query.AddTo(snapshot.documents_scored_per_query.buckets, snapshot.documents_scored_per_query.sum);
+        for (size_t i = 0; i < SEARCH_COUNTER_COUNT; ++i) {
+            snapshot.counters[i] += shard.counters[i].load(memory_order_relaxed);
+        }
+    }
+
+    auto count_total = [](HistogramSnapshot& histogram) {
+        histogram.count = 0;
+        for (uint64_t bucket : histogram.buckets) {
+            histogram.count += bucket;
+        }
+    };
+    for (auto& histogram : snapshot.stage_latency_ns) {
+        count_total(histogram);
+    }
+    count_total(snapshot.postings_per_query);
+    count_total(snapshot.documents_scored_per_query);
+    return snapshot;
+}
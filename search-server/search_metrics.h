@@ -0,0 +1,170 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+enum class SearchStage {
+    PARSE,
+    POSTING_SCAN,
+    MINUS_FILTER,
+    TOP_K,
+    QUERY,
+    ADD_DOCUMENT,
+    REMOVE_DOCUMENT,
+};
+
+enum class SearchCounter {
+    QUERIES,
+    POSTINGS_SCANNED,
+    DOCUMENTS_SCORED,
+    DOCUMENTS_ADDED,
+    DOCUMENTS_REMOVED,
+    CONTENTS_EVICTED,
+};
+
+constexpr size_t SEARCH_STAGE_COUNT = static_cast<size_t>(SearchStage::REMOVE_DOCUMENT) + 1;
+constexpr size_t SEARCH_COUNTER_COUNT = static_cast<size_t>(SearchCounter::CONTENTS_EVICTED) + 1;
+
+// Log-linear buckets in the spirit of HdrHistogram: every power of two is split
+// into 16 linear sub-buckets, so any recorded value is off by at most 1/16.
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BUCKET_BITS = 4;
+    static constexpr uint64_t SUB_BUCKET_COUNT = uint64_t{ 1 } << SUB_BUCKET_BITS;
+    static constexpr int MAX_SHIFT = 40;
+    static constexpr size_t BUCKET_COUNT = SUB_BUCKET_COUNT * (MAX_SHIFT + 2);
+
+    static size_t BucketIndex(uint64_t value) noexcept;
+    static uint64_t BucketLowerBound(size_t index) noexcept;
+
+    void Record(uint64_t value) noexcept {
+        buckets_[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    void AddTo(std::vector<uint64_t>& buckets, uint64_t& sum) const;
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets_;
+    std::atomic<uint64_t> sum_;
+};
+
+struct HistogramSnapshot {
+    std::vector<uint64_t> buckets = std::vector<uint64_t>(LatencyHistogram::BUCKET_COUNT);
+    uint64_t count = 0;
+    uint64_t sum = 0;
+
+    double Mean() const;
+    uint64_t Percentile(double percent) const;
+    uint64_t Max() const;
+};
+
+struct MetricsSnapshot {
+    std::array<HistogramSnapshot, SEARCH_STAGE_COUNT> stage_latency_ns;
+    HistogramSnapshot postings_per_query;
+    HistogramSnapshot documents_scored_per_query;
+    std::array<uint64_t, SEARCH_COUNTER_COUNT> counters{};
+
+    const HistogramSnapshot& Latency(SearchStage stage) const {
+        return stage_latency_ns[static_cast<size_t>(stage)];
+    }
+
+    uint64_t Counter(SearchCounter counter) const {
+        return counters[static_cast<size_t>(counter)];
+    }
+};
+
+std::ostream& operator<<(std::ostream& out, const MetricsSnapshot& snapshot);
+
+// On by default. Every thread writes into its own cache-aligned shard with relaxed
+// atomics, so recording never takes a lock and rarely shares a line. The shards are
+// allocated up front: SHARD_COUNT of them with nine histograms of BUCKET_COUNT
+// counters each, about 776 KB per instance whether or not anything is recorded.
+// Disabled, recording skips the clock reads and costs one relaxed load.
+class SearchMetrics {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    SearchMetrics();
+
+    void SetEnabled(bool enabled) noexcept {
+        enabled_.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool IsEnabled() const noexcept {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    void RecordStage(SearchStage stage, Clock::duration duration) noexcept {
+        if (!IsEnabled()) {
+            return;
+        }
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+        LocalShard().stage_latency[static_cast<size_t>(stage)].Record(static_cast<uint64_t>(ns));
+    }
+
+    void Increment(SearchCounter counter, uint64_t value = 1) noexcept {
+        if (!IsEnabled()) {
+            return;
+        }
+        LocalShard().counters[static_cast<size_t>(counter)].fetch_add(value, std::memory_order_relaxed);
+    }
+
+    void RecordQuery(uint64_t postings_scanned, uint64_t documents_scored) noexcept;
+
+    MetricsSnapshot GetSnapshot() const;
+
+private:
+    static constexpr size_t SHARD_COUNT = 16;
+
+    struct alignas(64) Shard {
+        std::array<LatencyHistogram, SEARCH_STAGE_COUNT> stage_latency;
+        LatencyHistogram postings_per_query;
+        LatencyHistogram documents_scored_per_query;
+        std::array<std::atomic<uint64_t>, SEARCH_COUNTER_COUNT> counters;
+    };
+
+    static size_t ThreadShardIndex() noexcept;
+
+    Shard& LocalShard() noexcept {
+        return shards_[ThreadShardIndex()];
+    }
+
+    std::unique_ptr<Shard[]> shards_;
+    std::atomic<bool> enabled_{ true };
+};
+
+class StageTimer {
+public:
+    StageTimer(SearchMetrics& metrics, SearchStage stage, std::chrono::nanoseconds* elapsed = nullptr)
+        : metrics_(metrics), stage_(stage), elapsed_(elapsed)
+        , timed_(elapsed || metrics.IsEnabled())
+        , start_time_(timed_ ? SearchMetrics::Clock::now() : SearchMetrics::Clock::time_point{}) {
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    ~StageTimer() {
+        if (!timed_) {
+            return;
+        }
+        const auto duration = SearchMetrics::Clock::now() - start_time_;
+        metrics_.RecordStage(stage_, duration);
+        if (elapsed_) {
+            *elapsed_ = std::chrono::duration_cast<std::chrono::nanoseconds>(duration);
+        }
+    }
+
+private:
+    SearchMetrics& metrics_;
+    const SearchStage stage_;
+    std::chrono::nanoseconds* const elapsed_;
+    const bool timed_;
+    const SearchMetrics::Clock::time_point start_time_;
+};
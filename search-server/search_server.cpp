@@ -2,24 +2,198 @@
 
 using namespace std;
 
+namespace {
+
+constexpr int CALIBRATION_REPEATS = 5;
+constexpr size_t CALIBRATION_MIN_POSTINGS = 256;
+constexpr size_t CALIBRATION_MAX_QUERY_WORDS = 64;
+constexpr size_t CALIBRATION_MAX_MATCH_WORDS = 4096;
+
+struct CalibrationSample {
+    size_t size = 0;
+    chrono::steady_clock::duration sequential;
+    chrono::steady_clock::duration parallel;
+};
+
+template <typename Func>
+chrono::steady_clock::duration MeasureBest(Func func) {
+    auto best = chrono::steady_clock::duration::max();
+    for (int repeat = 0; repeat < CALIBRATION_REPEATS; ++repeat) {
+        const auto start_time = chrono::steady_clock::now();
+        func();
+        best = min(best, chrono::steady_clock::now() - start_time);
+    }
+    return best;
+}
+
+// The smallest size from which parallel execution wins on every larger sample as
+// well; if it loses on the largest one, parallel execution is never chosen.
+size_t FindCrossover(const vector<CalibrationSample>& samples) {
+    size_t crossover = numeric_limits<size_t>::max();
+    for (auto it = samples.rbegin(); it != samples.rend() && it->parallel < it->sequential; ++it) {
+        crossover = it->size;
+    }
+    return crossover;
+}
+
+} // namespace
+
+bool IsRankedHigher(const Document& lhs, const Document& rhs) {
+    if (abs(lhs.relevance - rhs.relevance) < RELEVANCE_COMPARISON_ERR) {
+        if (lhs.rating != rhs.rating) {
+            return lhs.rating > rhs.rating;
+        }
+        return lhs.id < rhs.id;
+    }
+    return lhs.relevance > rhs.relevance;
+}
+
 SearchServer::SearchServer(string_view stop_words_text) : SearchServer::SearchServer(SplitIntoWords(stop_words_text)) {}
 SearchServer::SearchServer(const string& stop_words_text) : SearchServer::SearchServer(string_view(stop_words_text)) {}
 
+SearchServer::~SearchServer() {
+    unique_lock lock(async_mutex_);
+    async_done_.wait(lock, [this] {
+        return in_flight_queries_ == 0;
+        });
+}
+
 void SearchServer::AddDocument(int document_id, const string_view document, DocumentStatus status, const vector<int>& ratings) {
-    if ((document_id < 0) || (documents_.count(document_id) > 0)) {
+    StageTimer add_timer(metrics_, SearchStage::ADD_DOCUMENT);
+    InstallFinishedMerge(false);
+    if ((document_id < 0) || (document_ordinals_.count(document_id) > 0)) {
         throw invalid_argument("Invalid document_id"s);
     }
+    const auto word_freqs = ComputeWordFreqs(document);
+    if (!FitsMemoryBudget(document.size())) {
+        throw runtime_error("Memory budget exceeded"s);
+    }
+    CommitDocument(document_id, document, status, ratings, word_freqs);
+}
+
+vector<RejectedDocument> SearchServer::AddDocuments(const vector<DocumentRecord>& documents) {
+    InstallFinishedMerge(false);
+    // Tokenizing only reads the server, so the batch is split into words in parallel
+    // and then committed in order.
+    // Each document's ADD_DOCUMENT latency is its tokenizing time plus its commit time,
+    // so batch ingest shows up in the metrics like single adds.
+    vector<vector<pair<string_view, double>>> word_freqs(documents.size());
+    vector<string> errors(documents.size());
+    vector<SearchMetrics::Clock::duration> tokenize_times(documents.size());
+    vector<size_t> indexes(documents.size());
+    iota(indexes.begin(), indexes.end(), 0);
+    for_each(execution::par, indexes.begin(), indexes.end(), [&](size_t i) {
+        const auto start_time = SearchMetrics::Clock::now();
+        try {
+            word_freqs[i] = ComputeWordFreqs(documents[i].text);
+        }
+        catch (const invalid_argument& e) {
+            errors[i] = e.what();
+        }
+        tokenize_times[i] = SearchMetrics::Clock::now() - start_time;
+        });
 
-    const auto [it, inserted] = documents_.emplace(document_id, DocumentData{ ComputeAverageRating(ratings), status, string(document) });
+    const size_t new_size = document_external_ids_.size() + documents.size();
+    document_ratings_.reserve(new_size);
+    document_statuses_.reserve(new_size);
+    document_external_ids_.reserve(new_size);
+    document_term_freqs_.reserve(new_size);
+    document_alive_.reserve(new_size);
 
-    const auto words = SplitIntoWordsNoStop(it->second.content);
-    document_ids_.push_back(document_id);
+    vector<RejectedDocument> rejected;
+    for (size_t i = 0; i < documents.size(); ++i) {
+        const DocumentRecord& document = documents[i];
+        const auto start_time = SearchMetrics::Clock::now();
+        if (errors[i].empty() && ((document.id < 0) || (document_ordinals_.count(document.id) > 0))) {
+            errors[i] = "Invalid document_id"s;
+        }
+        if (errors[i].empty() && !FitsMemoryBudget(document.text.size())) {
+            errors[i] = "Memory budget exceeded"s;
+        }
+        if (!errors[i].empty()) {
+            rejected.push_back({ i, move(errors[i]) });
+        }
+        else {
+            CommitDocument(document.id, document.text, document.status, document.ratings, word_freqs[i]);
+        }
+        metrics_.RecordStage(SearchStage::ADD_DOCUMENT, tokenize_times[i] + (SearchMetrics::Clock::now() - start_time));
+    }
+    return rejected;
+}
 
+// Word views point into `document`; nothing is stored, so this may run concurrently.
+vector<pair<string_view, double>> SearchServer::ComputeWordFreqs(string_view document) const {
+    vector<string_view> words = SplitIntoWordsNoStop(document);
     const double inv_word_count = 1.0 / words.size();
-    for (const string_view word : words) {
-        word_to_document_freqs_[word][document_id] += inv_word_count;
-        document_to_word_freqs_[document_id][word] += inv_word_count;
+    sort(words.begin(), words.end());
+    vector<pair<string_view, double>> word_freqs;
+    for (auto it = words.begin(); it != words.end();) {
+        const auto run_end = find_if(it, words.end(), [it](string_view word) {
+            return word != *it;
+            });
+        // Repeated addition, as the index always summed term frequencies.
+        double term_freq = 0.0;
+        for (auto word = it; word != run_end; ++word) {
+            term_freq += inv_word_count;
+        }
+        word_freqs.emplace_back(*it, term_freq);
+        it = run_end;
+    }
+    return word_freqs;
+}
+
+// Usage is checked before the document is indexed, so a document can overshoot the
+// budget by its index entries; its text is accounted for up front.
+bool SearchServer::FitsMemoryBudget(size_t document_size) {
+    if (memory_budget_ == UNLIMITED_MEMORY) {
+        return true;
+    }
+    const size_t required = GetMemoryUsage().GetTotalBytes() + document_size;
+    if (required <= memory_budget_) {
+        return true;
+    }
+    // Flushing a small pending block cannot make room and only fragments the file.
+    if (memory_budget_policy_ != MemoryBudgetPolicy::EVICT_CONTENT
+        || document_contents_.GetReleasableBytes() < required - memory_budget_) {
+        return false;
+    }
+    metrics_.Increment(SearchCounter::CONTENTS_EVICTED, document_contents_.ReleaseMemory());
+    return GetMemoryUsage().GetTotalBytes() + document_size <= memory_budget_;
+}
+
+void SearchServer::CommitDocument(int document_id, string_view document, DocumentStatus status, const vector<int>& ratings,
+    const vector<pair<string_view, double>>& content_word_freqs) {
+    const int ordinal = static_cast<int>(document_external_ids_.size());
+    document_contents_.Append(document);
+    document_ratings_.push_back(ComputeAverageRating(ratings));
+    document_statuses_.push_back(status);
+    document_external_ids_.push_back(document_id);
+    document_ordinals_.emplace(document_id, ordinal);
+    document_ids_.push_back(document_id);
+
+    vector<pair<int, double>> term_freqs;
+    term_freqs.reserve(content_word_freqs.size());
+    for (const auto& [word, term_freq] : content_word_freqs) {
+        const int term_id = term_dictionary_.FindOrAdd(word);
+        if (static_cast<size_t>(term_id) == document_freqs_.size()) {
+            document_freqs_.push_back(0);
+            const pair<string_view, int> recent_term{ term_dictionary_.GetTerm(term_id), term_id };
+            recent_terms_.insert(upper_bound(recent_terms_.begin(), recent_terms_.end(), recent_term), recent_term);
+        }
+        ++document_freqs_[term_id];
+        term_freqs.emplace_back(term_id, term_freq);
+    }
+    sort(term_freqs.begin(), term_freqs.end());
+    document_term_freqs_.emplace_back(term_freqs.begin(), term_freqs.end());
+    mutable_segment_.AddDocument(ordinal, term_freqs);
+    if (impact_ordering_enabled_) {
+        AddImpactPostings(ordinal);
+    }
+    document_alive_.push_back(1);
+    if (mutable_segment_.GetDocumentCount() >= segment_flush_threshold_) {
+        FlushMutableSegment();
     }
+    metrics_.Increment(SearchCounter::DOCUMENTS_ADDED);
 }
 
 vector<Document> SearchServer::FindTopDocuments(string_view raw_query, DocumentStatus status) const {
@@ -36,6 +210,12 @@ vector<Document> SearchServer::FindTopDocuments(execution::parallel_policy, stri
         });
 }
 
+vector<Document> SearchServer::FindTopDocuments(AutoPolicy, string_view raw_query, DocumentStatus status) const {
+    return FindTopDocuments(auto_policy, raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
+        return document_status == status;
+        });
+}
+
 vector<Document> SearchServer::FindTopDocuments(string_view raw_query) const {
     return FindTopDocuments(execution::seq, raw_query);
 }
@@ -45,9 +225,191 @@ vector<Document> SearchServer::FindTopDocuments(execution::sequenced_policy, str
 vector<Document> SearchServer::FindTopDocuments(execution::parallel_policy, string_view raw_query) const {
     return FindTopDocuments(execution::par, raw_query, DocumentStatus::ACTUAL);
 }
+vector<Document> SearchServer::FindTopDocuments(AutoPolicy, string_view raw_query) const {
+    return FindTopDocuments(auto_policy, raw_query, DocumentStatus::ACTUAL);
+}
+
+vector<Document> SearchServer::FindTopDocuments(QueryMode mode, string_view raw_query, DocumentStatus status) const {
+    return FindTopDocuments(mode, raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
+        return document_status == status;
+        });
+}
+vector<Document> SearchServer::FindTopDocuments(QueryMode mode, string_view raw_query) const {
+    return FindTopDocuments(mode, raw_query, DocumentStatus::ACTUAL);
+}
+
+SearchPage SearchServer::FindTopDocuments(string_view raw_query, DocumentStatus status, const SearchCursor& cursor, size_t page_size) const {
+    return FindPage(raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
+        return document_status == status;
+        }, status, cursor, page_size);
+}
+SearchPage SearchServer::FindTopDocuments(string_view raw_query, const SearchCursor& cursor, size_t page_size) const {
+    return FindTopDocuments(raw_query, DocumentStatus::ACTUAL, cursor, page_size);
+}
+
+CollectionStats SearchServer::GetCollectionStats(string_view raw_query) const {
+    QueryArena::Scope arena_scope;
+    const Query query = ParseQuery(raw_query, false, arena_scope.Resource());
+    CollectionStats stats;
+    stats.document_count = GetDocumentCount();
+    for (const string_view word : query.plus_words) {
+        stats.document_freqs.emplace(word, GetDocumentFreq(term_dictionary_.Find(word)));
+    }
+    return stats;
+}
+
+vector<Document> SearchServer::FindTopDocuments(string_view raw_query, DocumentStatus status, const CollectionStats& collection_stats) const {
+    return FindTopDocuments(raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
+        return document_status == status;
+        }, collection_stats);
+}
+
+ProfiledDocuments SearchServer::FindTopDocumentsWithProfile(string_view raw_query, DocumentStatus status) const {
+    return FindTopDocumentsWithProfile(execution::seq, raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
+        return document_status == status;
+        });
+}
+ProfiledDocuments SearchServer::FindTopDocumentsWithProfile(string_view raw_query) const {
+    return FindTopDocumentsWithProfile(raw_query, DocumentStatus::ACTUAL);
+}
+
+future<SearchResult> SearchServer::FindTopDocumentsAsync(string_view raw_query, chrono::steady_clock::duration budget) const {
+    return FindTopDocumentsAsync(raw_query, [](int document_id, DocumentStatus document_status, int rating) {
+        return document_status == DocumentStatus::ACTUAL;
+        }, budget);
+}
+
+void SearchServer::SetMaxInFlightQueries(size_t max_queries) {
+    lock_guard guard(async_mutex_);
+    max_in_flight_queries_ = max_queries;
+}
+
+size_t SearchServer::GetInFlightQueries() const {
+    lock_guard guard(async_mutex_);
+    return in_flight_queries_;
+}
+
+SearchServer::QuerySlot::QuerySlot(const SearchServer& server)
+    : server_(server) {
+    lock_guard guard(server_.async_mutex_);
+    if (server_.in_flight_queries_ >= server_.max_in_flight_queries_) {
+        throw runtime_error("Too many queries in flight"s);
+    }
+    ++server_.in_flight_queries_;
+}
+
+SearchServer::QuerySlot::~QuerySlot() {
+    lock_guard guard(server_.async_mutex_);
+    --server_.in_flight_queries_;
+    server_.async_done_.notify_all();
+}
+
+// A cached ranking is a snapshot: it keeps serving pages until it expires, even if
+// documents were added or removed since, so no page skips or repeats a document.
+optional<SearchPage> SearchServer::FindCachedPage(string_view raw_query, DocumentStatus status, const SearchCursor& cursor, size_t page_size) const {
+    if (!cursor.started_) {
+        return nullopt;
+    }
+
+    shared_ptr<const CachedCandidates> candidates;
+    {
+        lock_guard guard(cursor_cache_mutex_);
+        const auto it = find_if(cursor_cache_.begin(), cursor_cache_.end(), [&cursor](const auto& entry) {
+            return entry->token == cursor.cache_token_;
+            });
+        if (it == cursor_cache_.end()) {
+            return nullopt;
+        }
+        candidates = *it;
+    }
+
+    const size_t offset = cursor.offset_;
+    if (candidates->raw_query != raw_query
+        || candidates->status != status
+        || candidates->expires_at < chrono::steady_clock::now()
+        || offset == 0 || offset > candidates->ranked.size()
+        || candidates->ranked[offset - 1].id != cursor.document_id_) {
+        return nullopt;
+    }
+    return MakePage(*candidates, offset, page_size);
+}
+
+// A fresh ranking resumes right after the last document returned. Relevance shifts
+// whenever the collection changes, so the cursor's relevance is only used when that
+// document is no longer among the candidates.
+SearchPage SearchServer::CacheRankedDocuments(string_view raw_query, optional<DocumentStatus> status, vector<Document> ranked,
+    const SearchCursor& cursor, size_t page_size) const {
+    auto candidates = make_shared<CachedCandidates>();
+    candidates->raw_query = string(raw_query);
+    candidates->expires_at = chrono::steady_clock::now() + CURSOR_CACHE_TTL;
+    candidates->ranked = move(ranked);
+
+    size_t offset = 0;
+    if (cursor.started_) {
+        auto& documents = candidates->ranked;
+        const auto seen = find_if(documents.begin(), documents.end(), [&cursor](const Document& document) {
+            return document.id == cursor.document_id_ && document.rating == cursor.rating_;
+            });
+        if (seen != documents.end()) {
+            offset = seen - documents.begin() + 1;
+        }
+        else {
+            const Document last_seen(cursor.document_id_, cursor.relevance_, cursor.rating_);
+            offset = partition_point(documents.begin(), documents.end(), [&last_seen](const Document& document) {
+                return !IsRankedHigher(last_seen, document);
+                }) - documents.begin();
+        }
+    }
+
+    if (!status) {
+        return MakePage(*candidates, offset, page_size);
+    }
+    candidates->status = *status;
+    {
+        lock_guard guard(cursor_cache_mutex_);
+        candidates->token = ++next_cursor_token_;
+        const auto now = chrono::steady_clock::now();
+        cursor_cache_.erase(remove_if(cursor_cache_.begin(), cursor_cache_.end(), [now](const auto& entry) {
+            return entry->expires_at < now;
+            }), cursor_cache_.end());
+        if (cursor_cache_.size() >= CURSOR_CACHE_CAPACITY) {
+            cursor_cache_.pop_front();
+        }
+        cursor_cache_.push_back(candidates);
+    }
+    return MakePage(*candidates, offset, page_size);
+}
+
+SearchPage SearchServer::MakePage(const CachedCandidates& candidates, size_t offset, size_t page_size) {
+    const size_t page_end = min(candidates.ranked.size(), offset + page_size);
+    SearchPage page;
+    page.documents.assign(candidates.ranked.begin() + offset, candidates.ranked.begin() + page_end);
+    page.next.started_ = true;
+    page.next.cache_token_ = candidates.token;
+    page.next.offset_ = page_end;
+    page.next.exhausted_ = page_end == candidates.ranked.size();
+    if (!page.documents.empty()) {
+        const Document& last = page.documents.back();
+        page.next.relevance_ = last.relevance;
+        page.next.rating_ = last.rating;
+        page.next.document_id_ = last.id;
+    }
+    return page;
+}
+
+unique_ptr<SearchServer::AsyncQuery> SearchServer::StartAsyncQuery(string_view raw_query, chrono::steady_clock::duration budget) const {
+    auto request = make_unique<AsyncQuery>(*this);
+    request->text = string(raw_query);
+    {
+        StageTimer parse_timer(metrics_, SearchStage::PARSE);
+        request->query = ParseQuery(request->text);
+    }
+    request->context.deadline = chrono::steady_clock::now() + budget;
+    return request;
+}
 
 int SearchServer::GetDocumentCount() const {
-    return documents_.size();
+    return static_cast<int>(document_ordinals_.size());
 }
 
 vector<int>::const_iterator SearchServer::begin() const {
@@ -63,43 +425,39 @@ tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(string_vi
 }
 
 tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(execution::sequenced_policy, string_view raw_query, int document_id) const {
-    const Query query = ParseQuery(raw_query);
+    QueryArena::Scope arena_scope;
+    const Query query = ParseQuery(raw_query, false, arena_scope.Resource());
+    const int ordinal = GetOrdinal(document_id);
 
     for (string_view word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        if (word_to_document_freqs_.at(word).count(document_id)) {
-            return { vector<string_view>{}, documents_.at(document_id).status };
+        if (FindTermFreq(ordinal, term_dictionary_.Find(word))) {
+            return { vector<string_view>{}, document_statuses_[ordinal] };
         }
     }
 
-
     vector<string_view> matched_words;
     for (const string_view& word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        if (word_to_document_freqs_.at(word).count(document_id)) {
+        if (FindTermFreq(ordinal, term_dictionary_.Find(word))) {
             matched_words.push_back(word);
         }
     }
 
-    return { matched_words, documents_.at(document_id).status };
+    return { matched_words, document_statuses_[ordinal] };
 }
 
 tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(execution::parallel_policy, string_view raw_query, int document_id) const {   
-    const auto query = ParseQuery(raw_query, true); 
+    QueryArena::Scope arena_scope;
+    const auto query = ParseQuery(raw_query, true, arena_scope.Resource());
 
-    const auto status = documents_.at(document_id).status;
+    const int ordinal = GetOrdinal(document_id);
+    const auto status = document_statuses_[ordinal];
 
-    const auto func_check = [this, document_id](const string_view& word) {
-        auto it = word_to_document_freqs_.find(word);
-        return it != word_to_document_freqs_.end() && it->second.count(document_id);
+    const auto func_check = [this, ordinal](const string_view& word) {
+        return FindTermFreq(ordinal, term_dictionary_.Find(word)) != nullptr;
     };
 
     if (any_of(execution::par, query.minus_words.begin(), query.minus_words.end(), func_check)) {
-        return { {}, status };
+        return { vector<string_view>{}, status };
     }
 
     vector<string_view> matched_words(query.plus_words.size());
@@ -113,8 +471,17 @@ tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(execution
     return { matched_words,  status };
 }
 
+// Query words are counted without parsing; a rough count is all the choice needs.
+tuple<vector<string_view>, DocumentStatus> SearchServer::MatchDocument(AutoPolicy, string_view raw_query, int document_id) const {
+    const size_t word_count = count(raw_query.begin(), raw_query.end(), ' ') + 1;
+    if (word_count >= auto_policy_thresholds_.words) {
+        return MatchDocument(execution::par, raw_query, document_id);
+    }
+    return MatchDocument(execution::seq, raw_query, document_id);
+}
+
 bool SearchServer::IsStopWord(string_view word) const {
-    return stop_words_.count(word) > 0;
+    return stop_words_.Contains(word);
 }
 
 bool SearchServer::IsValidWord(string_view word) {
@@ -156,20 +523,34 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(string_view text) const {
     if (text.empty() || text[0] == '-' || !IsValidWord(text)) {
         throw invalid_argument("Query word "s + text.data() + " is invalid");
     }
+    bool is_prefix = false;
+    if (text.size() > 1 && text.back() == '*') {
+        is_prefix = true;
+        text.remove_suffix(1);
+    }
 
-    return { text, is_minus, IsStopWord(text) };
+    return { text, is_minus, !is_prefix && IsStopWord(text), is_prefix };
 }
 
-SearchServer::Query SearchServer::ParseQuery(string_view text, bool skip_sort) const {
-    Query result;
-    for (const string_view word : SplitIntoWords(text)) {
+SearchServer::Query SearchServer::ParseQuery(string_view text, bool skip_sort, pmr::memory_resource* resource) const {
+    Query result(resource);
+    for (const string_view word : SplitIntoWords(text, resource)) {
         const auto query_word = ParseQueryWord(word);
-        if (!query_word.is_stop) {
+        if (query_word.is_prefix) {
+            auto& words = query_word.is_minus ? result.minus_words : result.plus_words;
+            const size_t first = words.size();
+            ExpandPrefix(query_word.data, words);
+            if (!query_word.is_minus) {
+                result.plus_groups.emplace_back(words.begin() + first, words.end());
+            }
+        }
+        else if (!query_word.is_stop) {
             if (query_word.is_minus) {
                 result.minus_words.push_back(query_word.data);
             }
             else {
                 result.plus_words.push_back(query_word.data);
+                result.plus_groups.emplace_back(1, query_word.data);
             }
         }
     }
@@ -183,53 +564,478 @@ SearchServer::Query SearchServer::ParseQuery(string_view text, bool skip_sort) c
     return result;
 }
 
-double SearchServer::ComputeWordInverseDocumentFreq(const string_view& word) const {
-    return log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
+// A prefix word is replaced by the live terms it starts; the views point into the
+// term dictionary, so they outlive the query text.
+void SearchServer::ExpandPrefix(string_view prefix, pmr::vector<string_view>& words) const {
+    size_t expansions = 0;
+    const auto add = [&](int term_id) {
+        if (document_freqs_[term_id] == 0) {
+            return;
+        }
+        if (++expansions > MAX_PREFIX_EXPANSIONS) {
+            throw invalid_argument("Query word "s + string(prefix) + "* matches too many terms"s);
+        }
+        words.push_back(term_dictionary_.GetTerm(term_id));
+    };
+    term_trie_.ForEachWithPrefix(prefix, add);
+    auto it = lower_bound(recent_terms_.begin(), recent_terms_.end(), prefix, [](const pair<string_view, int>& term, string_view prefix) {
+        return term.first < prefix;
+        });
+    for (; it != recent_terms_.end() && it->first.substr(0, prefix.size()) == prefix; ++it) {
+        add(it->second);
+    }
+}
+
+size_t SearchServer::ChooseWorkerCount(size_t total_postings) {
+    const size_t hardware_threads = max<size_t>(thread::hardware_concurrency(), 1);
+    return clamp<size_t>(total_postings / MIN_POSTINGS_PER_WORKER, 1, hardware_threads);
 }
 
-const map<string_view, double>& SearchServer::GetWordFrequencies(int document_id) {
-    static const map<string_view, double> empty_map;
+// Returns worker_count + 1 ordinal bounds; the k-th cut is the smallest ordinal with
+// at least k / worker_count of all postings before it.
+pmr::vector<int> SearchServer::PartitionOrdinals(const pmr::vector<ScanTask>& tasks, size_t total_postings,
+    size_t worker_count, int end_ordinal, pmr::memory_resource* resource) {
+    const auto postings_before = [&tasks](int ordinal) {
+        size_t count = 0;
+        for (const ScanTask& task : tasks) {
+            count += lower_bound(task.postings.ordinals, task.postings.ordinals + task.postings.size, ordinal) - task.postings.ordinals;
+        }
+        return count;
+    };
+
+    pmr::vector<int> bounds(resource);
+    bounds.reserve(worker_count + 1);
+    bounds.push_back(0);
+    for (size_t k = 1; k < worker_count; ++k) {
+        const size_t target = total_postings * k / worker_count;
+        int low = bounds.back();
+        int high = end_ordinal;
+        while (low < high) {
+            const int middle = low + (high - low) / 2;
+            if (postings_before(middle) < target) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        bounds.push_back(low);
+    }
+    bounds.push_back(end_ordinal);
+    return bounds;
+}
+
+size_t SearchServer::EstimatePostingVolume(const Query& query) const {
+    size_t volume = 0;
+    for (const string_view word : query.plus_words) {
+        volume += GetDocumentFreq(term_dictionary_.Find(word));
+    }
+    return volume;
+}
+
+AutoPolicyThresholds SearchServer::CalibrateAutoPolicy() {
+    AutoPolicyThresholds thresholds = auto_policy_thresholds_;
+    // Live terms from the most to the least frequent. Terms that would parse as minus
+    // or prefix words are left out.
+    vector<pair<int, int>> terms;
+    for (size_t term_id = 0; term_id < document_freqs_.size(); ++term_id) {
+        if (document_freqs_[term_id] > 0 && term_dictionary_.GetTerm(term_id)[0] != '-'
+            && term_dictionary_.GetTerm(term_id).back() != '*') {
+            terms.emplace_back(document_freqs_[term_id], static_cast<int>(term_id));
+        }
+    }
+    sort(terms.rbegin(), terms.rend());
+    const auto accept_all = [](int, DocumentStatus, int) {
+        return true;
+    };
+
+    // Queries of doubling posting volume, filled greedily with the largest terms that fit.
+    size_t total_postings = 0;
+    for (const auto& [document_freq, term_id] : terms) {
+        total_postings += document_freq;
+    }
+    // Restores impact ordering on every exit, including an exception from a timed query.
+    struct ImpactOrderingGuard {
+        bool& enabled;
+        const bool saved = enabled;
+
+        ~ImpactOrderingGuard() {
+            enabled = saved;
+        }
+    } impact_ordering_guard{ impact_ordering_enabled_ };
+    impact_ordering_enabled_ = false;
+    vector<CalibrationSample> query_samples;
+    for (size_t target = CALIBRATION_MIN_POSTINGS; target <= total_postings; target *= 2) {
+        string query;
+        size_t volume = 0;
+        size_t word_count = 0;
+        for (const auto& [document_freq, term_id] : terms) {
+            if (volume + document_freq > target) {
+                continue;
+            }
+            query += (query.empty() ? ""s : " "s) + string(term_dictionary_.GetTerm(term_id));
+            volume += document_freq;
+            if (++word_count == CALIBRATION_MAX_QUERY_WORDS || volume * 2 >= target) {
+                break;
+            }
+        }
+        if (volume == 0 || (!query_samples.empty() && query_samples.back().size >= volume)) {
+            continue;
+        }
+        query_samples.push_back({ volume,
+            MeasureBest([&] { FindTopDocuments(execution::seq, query, accept_all); }),
+            MeasureBest([&] { FindTopDocuments(execution::par, query, accept_all); }) });
+    }
+    if (!query_samples.empty()) {
+        thresholds.query_postings = FindCrossover(query_samples);
+    }
+
+    // Matching and removal do a small fixed amount of work per word, so one crossover
+    // measured on MatchDocument serves both.
+    vector<CalibrationSample> word_samples;
+    if (!document_ids_.empty()) {
+        const int document_id = document_ids_.front();
+        string query;
+        size_t word_count = 0;
+        for (size_t size = 1; size <= min(terms.size(), CALIBRATION_MAX_MATCH_WORDS); size *= 2) {
+            for (; word_count < size; ++word_count) {
+                query += (query.empty() ? ""s : " "s) + string(term_dictionary_.GetTerm(terms[word_count].second));
+            }
+            word_samples.push_back({ size,
+                MeasureBest([&] { MatchDocument(execution::seq, query, document_id); }),
+                MeasureBest([&] { MatchDocument(execution::par, query, document_id); }) });
+        }
+    }
+    if (!word_samples.empty()) {
+        thresholds.words = FindCrossover(word_samples);
+    }
+
+    auto_policy_thresholds_ = thresholds;
+    return thresholds;
+}
+
+void SearchServer::SetAutoPolicyThresholds(const AutoPolicyThresholds& thresholds) {
+    auto_policy_thresholds_ = thresholds;
+}
+
+AutoPolicyThresholds SearchServer::GetAutoPolicyThresholds() const {
+    return auto_policy_thresholds_;
+}
+
+int SearchServer::GetDocumentFreq(int term_id) const {
+    return term_id == TermDictionary::NOT_FOUND ? 0 : document_freqs_[term_id];
+}
+
+double SearchServer::ComputeWordInverseDocumentFreq(string_view word, int document_freq, const QueryContext& context) const {
+    if (context.collection_stats) {
+        const auto it = context.collection_stats->document_freqs.find(word);
+        if (it != context.collection_stats->document_freqs.end()) {
+            return log(context.collection_stats->document_count * 1.0 / it->second);
+        }
+    }
+    return log(GetDocumentCount() * 1.0 / document_freq);
+}
 
-    if (document_to_word_freqs_.count(document_id) == 0) {
-        return empty_map;
+int SearchServer::GetOrdinal(int document_id) const {
+    const auto it = document_ordinals_.find(document_id);
+    if (it == document_ordinals_.end()) {
+        throw out_of_range("Unknown document_id"s);
     }
+    return it->second;
+}
+
+const double* SearchServer::FindTermFreq(int ordinal, int term_id) const {
+    const auto& term_freqs = document_term_freqs_[ordinal];
+    const auto it = lower_bound(term_freqs.begin(), term_freqs.end(), term_id, [](const pair<int, double>& entry, int term_id) {
+        return entry.first < term_id;
+        });
+    return it != term_freqs.end() && it->first == term_id ? &it->second : nullptr;
+}
 
-    return document_to_word_freqs_.at(document_id);
+const map<string_view, double>& SearchServer::GetWordFrequencies(int document_id) {
+    word_frequencies_.clear();
+    const auto it = document_ordinals_.find(document_id);
+    if (it != document_ordinals_.end()) {
+        for (const auto& [term_id, term_freq] : document_term_freqs_[it->second]) {
+            word_frequencies_.emplace(term_dictionary_.GetTerm(term_id), term_freq);
+        }
+    }
+    return word_frequencies_;
 }
 
 void SearchServer::RemoveDocument(int document_id) {
-    documents_.erase(document_id);
-    for (const auto& pair : document_to_word_freqs_.at(document_id)) {
-        word_to_document_freqs_[pair.first].erase(document_id);
+    StageTimer remove_timer(metrics_, SearchStage::REMOVE_DOCUMENT);
+    InstallFinishedMerge(false);
+    const int ordinal = GetOrdinal(document_id);
+    for (const auto& [term_id, term_freq] : document_term_freqs_[ordinal]) {
+        --document_freqs_[term_id];
+        RemoveImpactPosting(term_id, term_freq, ordinal);
     }
-    document_to_word_freqs_.erase(document_id);
-    document_ids_.erase(find(document_ids_.begin(), document_ids_.end(), document_id));
+    ReleaseOrdinal(document_id, ordinal);
+    metrics_.Increment(SearchCounter::DOCUMENTS_REMOVED);
 }
 void SearchServer::RemoveDocument(execution::sequenced_policy ex_policy, int document_id) {
     RemoveDocument(document_id);
 }
 void SearchServer::RemoveDocument(execution::parallel_policy ex_policy, int document_id) {
-    
-
-    const auto& word_freqs = document_to_word_freqs_.at(document_id);
-    vector<const string_view*> words(word_freqs.size());
-
-    transform(
-        word_freqs.begin(), word_freqs.end(),
-        words.begin(),
-        [](const auto& item) {
-            return &item.first;
-        });
+    StageTimer remove_timer(metrics_, SearchStage::REMOVE_DOCUMENT);
+    InstallFinishedMerge(false);
+    const int ordinal = GetOrdinal(document_id);
 
+    const auto& term_freqs = document_term_freqs_[ordinal];
     for_each(
         ex_policy,
-        words.begin(), words.end(),
-        [this, document_id](const string_view* ptr) {
-            word_to_document_freqs_.at(*ptr).erase(document_id);
+        term_freqs.begin(), term_freqs.end(),
+        [this, ordinal](const pair<int, double>& item) {
+            --document_freqs_[item.first];
+            RemoveImpactPosting(item.first, item.second, ordinal);
         });
 
-    documents_.erase(document_id);
-    document_to_word_freqs_.erase(document_id);
+    ReleaseOrdinal(document_id, ordinal);
+    metrics_.Increment(SearchCounter::DOCUMENTS_REMOVED);
+}
+
+void SearchServer::RemoveDocument(AutoPolicy, int document_id) {
+    if (document_term_freqs_[GetOrdinal(document_id)].size() >= auto_policy_thresholds_.words) {
+        RemoveDocument(execution::par, document_id);
+    }
+    else {
+        RemoveDocument(execution::seq, document_id);
+    }
+}
+
+void SearchServer::ReleaseOrdinal(int document_id, int ordinal) {
+    document_term_freqs_[ordinal].clear();
+    document_term_freqs_[ordinal].shrink_to_fit();
+    document_alive_[ordinal] = 0;
+    document_ordinals_.erase(document_id);
     document_ids_.erase(find(document_ids_.begin(), document_ids_.end(), document_id));
 }
 
+MetricsSnapshot SearchServer::GetMetrics() const {
+    return metrics_.GetSnapshot();
+}
+
+void SearchServer::EnableMetrics(bool enabled) {
+    metrics_.SetEnabled(enabled);
+}
+
+void SearchServer::SetSegmentFlushThreshold(size_t documents) {
+    if (documents == 0) {
+        throw invalid_argument("Segment flush threshold must be positive"s);
+    }
+    segment_flush_threshold_ = documents;
+}
+
+void SearchServer::WaitForMerges() {
+    while (pending_merge_.valid() || pending_term_trie_.valid()) {
+        InstallFinishedMerge(true);
+    }
+}
+
+MemoryUsage SearchServer::GetMemoryUsage() const {
+    MemoryUsage usage;
+    for (size_t i = 0; i < MEMORY_CATEGORY_COUNT; ++i) {
+        usage.bytes[i] = memory_resources_[i].GetBytes();
+    }
+    usage.bytes[static_cast<size_t>(MemoryCategory::DOCUMENT_TABLE)] += document_ids_.capacity() * sizeof(int);
+    usage.dead_ordinals = document_alive_.size() - document_ids_.size();
+    return usage;
+}
+
+void SearchServer::SetMemoryBudget(size_t bytes, MemoryBudgetPolicy policy) {
+    memory_budget_ = bytes;
+    memory_budget_policy_ = policy;
+}
+
+string SearchServer::GetDocumentContent(int document_id) const {
+    return document_contents_.Get(GetOrdinal(document_id));
+}
+
+void SearchServer::SetContentCacheCapacity(size_t blocks) {
+    document_contents_.SetCacheCapacity(blocks);
+}
+
+void SearchServer::SetScoringPrecision(ScoringPrecision precision) {
+    scoring_precision_ = precision;
+}
+
+void SearchServer::EnableImpactOrdering(bool enabled) {
+    impact_ordering_enabled_ = enabled;
+    impact_postings_.clear();
+    if (enabled) {
+        for (const int document_id : document_ids_) {
+            AddImpactPostings(document_ordinals_.at(document_id));
+        }
+    }
+}
+
+void SearchServer::AddImpactPostings(int ordinal) {
+    impact_postings_.resize(term_dictionary_.GetTermCount());
+    for (const auto& [term_id, term_freq] : document_term_freqs_[ordinal]) {
+        impact_postings_[term_id].emplace(term_freq, ordinal);
+    }
+}
+
+void SearchServer::RemoveImpactPosting(int term_id, double term_freq, int ordinal) {
+    if (impact_ordering_enabled_) {
+        impact_postings_[term_id].erase({ term_freq, ordinal });
+    }
+}
+
+size_t SearchServer::GetSegmentCount() const {
+    return segments_.size() + (mutable_segment_.GetDocumentCount() > 0 ? 1 : 0);
+}
+
+void SearchServer::FlushMutableSegment() {
+    segments_.push_back(IndexSegment::Build(mutable_segment_, static_cast<int>(document_alive_.size()),
+        document_alive_.data(), 0, MemoryResource(MemoryCategory::POSTINGS)));
+    mutable_segment_.Clear();
+    MaybeStartMerge();
+    MaybeStartTermTrieBuild();
+}
+
+// The merged segment already uses the new ordinals for [first_ordinal, end_ordinal);
+// everything indexed by ordinal follows it, and later ordinals move down by the number
+// of slots dropped. Documents removed while the merge ran keep a (dead) slot.
+void SearchServer::RenumberOrdinals(const vector<int>& new_ordinals, int first_ordinal, int end_ordinal) {
+    const int ordinal_count = static_cast<int>(document_alive_.size());
+    const int shift = end_ordinal - segments_[pending_merge_begin_]->GetEndOrdinal();
+    vector<char> keep(ordinal_count - first_ordinal, 1);
+    for (int ordinal = first_ordinal; ordinal < ordinal_count; ++ordinal) {
+        const int new_ordinal = ordinal < end_ordinal ? new_ordinals[ordinal - first_ordinal] : ordinal - shift;
+        if (new_ordinal < 0) {
+            keep[ordinal - first_ordinal] = 0;
+            continue;
+        }
+        document_ratings_[new_ordinal] = document_ratings_[ordinal];
+        document_statuses_[new_ordinal] = document_statuses_[ordinal];
+        document_external_ids_[new_ordinal] = document_external_ids_[ordinal];
+        document_alive_[new_ordinal] = document_alive_[ordinal];
+        if (new_ordinal != ordinal) {
+            document_term_freqs_[new_ordinal] = move(document_term_freqs_[ordinal]);
+        }
+        if (document_alive_[new_ordinal]) {
+            document_ordinals_[document_external_ids_[new_ordinal]] = new_ordinal;
+        }
+    }
+    const size_t new_count = ordinal_count - shift;
+    document_ratings_.resize(new_count);
+    document_statuses_.resize(new_count);
+    document_external_ids_.resize(new_count);
+    document_alive_.resize(new_count);
+    document_term_freqs_.resize(new_count);
+    document_contents_.Erase(first_ordinal, keep);
+
+    for (size_t i = pending_merge_begin_ + 1; i < segments_.size(); ++i) {
+        segments_[i] = IndexSegment::Renumber(*segments_[i], -shift, MemoryResource(MemoryCategory::POSTINGS));
+    }
+    if (mutable_segment_.GetDocumentCount() > 0) {
+        mutable_segment_.Renumber(-shift);
+    }
+    if (impact_ordering_enabled_) {
+        EnableImpactOrdering(true);
+    }
+}
+
+// The build works on views of the terms known now; terms added meanwhile stay in
+// recent_terms_ when it is swapped in.
+void SearchServer::MaybeStartTermTrieBuild() {
+    if (pending_term_trie_.valid() || recent_terms_.size() * TERM_TRIE_REBUILD_FACTOR <= term_trie_.GetTermCount()) {
+        return;
+    }
+    vector<string_view> terms(term_dictionary_.GetTermCount());
+    for (size_t term_id = 0; term_id < terms.size(); ++term_id) {
+        terms[term_id] = term_dictionary_.GetTerm(term_id);
+    }
+    pending_term_trie_ = async(launch::async, [terms = move(terms), resource = MemoryResource(MemoryCategory::TERM_DICTIONARY)] {
+        TermTrie trie(resource);
+        trie.Build(terms);
+        return trie;
+        });
+}
+
+void SearchServer::InstallTermTrie(bool wait) {
+    if (!pending_term_trie_.valid()) {
+        return;
+    }
+    if (!wait && pending_term_trie_.wait_for(chrono::seconds(0)) != future_status::ready) {
+        return;
+    }
+    term_trie_ = pending_term_trie_.get();
+    const int covered = static_cast<int>(term_trie_.GetTermCount());
+    recent_terms_.erase(remove_if(recent_terms_.begin(), recent_terms_.end(), [covered](const pair<string_view, int>& term) {
+        return term.second < covered;
+        }), recent_terms_.end());
+}
+
+// Merges the oldest run of SEGMENT_MERGE_FACTOR adjacent segments of one level, so every
+// document is rewritten O(log N) times. Only one merge runs at a time; it works on
+// its own copies and is swapped in by the next write that finds it finished.
+void SearchServer::MaybeStartMerge() {
+    if (pending_merge_.valid()) {
+        return;
+    }
+    size_t end = 0;
+    size_t run = 0;
+    while (end < segments_.size() && run < SEGMENT_MERGE_FACTOR) {
+        run = (run > 0 && segments_[end - 1]->GetLevel() == segments_[end]->GetLevel()) ? run + 1 : 1;
+        ++end;
+    }
+    const auto is_sparse = [this](int first_ordinal, int end_ordinal) {
+        const size_t dead = count(document_alive_.begin() + first_ordinal, document_alive_.begin() + end_ordinal, 0);
+        return dead > 0 && dead * ORDINAL_COMPACTION_FACTOR >= static_cast<size_t>(end_ordinal - first_ordinal);
+    };
+    if (run < SEGMENT_MERGE_FACTOR) {
+        // No run to merge: rewrite a segment on its own once enough of it is dead.
+        end = 0;
+        while (end < segments_.size() && !is_sparse(segments_[end]->GetFirstOrdinal(), segments_[end]->GetEndOrdinal())) {
+            ++end;
+        }
+        if (end == segments_.size()) {
+            return;
+        }
+        run = 1;
+        ++end;
+    }
+    const size_t begin = end - run;
+
+    vector<shared_ptr<const IndexSegment>> inputs(segments_.begin() + begin, segments_.begin() + end);
+    const int first_ordinal = inputs.front()->GetFirstOrdinal();
+    const int end_ordinal = inputs.back()->GetEndOrdinal();
+    // Merges go left to right, so the segments after the range, which are copied with
+    // shifted ordinals on install, are the smaller ones.
+    const bool renumber = is_sparse(first_ordinal, end_ordinal);
+    auto new_ordinals = make_shared<vector<int>>(end_ordinal - first_ordinal);
+    int next_ordinal = first_ordinal;
+    for (int ordinal = first_ordinal; ordinal < end_ordinal; ++ordinal) {
+        const bool alive = document_alive_[ordinal];
+        (*new_ordinals)[ordinal - first_ordinal] = !alive ? -1 : renumber ? next_ordinal++ : ordinal;
+    }
+    const int merged_end_ordinal = renumber ? next_ordinal : end_ordinal;
+    pending_merge_ = async(launch::async, [inputs = move(inputs), new_ordinals, first_ordinal, merged_end_ordinal, resource = MemoryResource(MemoryCategory::POSTINGS)] {
+        return IndexSegment::Merge(inputs, new_ordinals->data(), first_ordinal, merged_end_ordinal, resource);
+        });
+    pending_merge_begin_ = begin;
+    pending_merge_end_ = end;
+    pending_merge_ordinals_ = renumber ? move(new_ordinals) : nullptr;
+}
+
+void SearchServer::InstallFinishedMerge(bool wait) {
+    InstallTermTrie(wait);
+    if (!pending_merge_.valid()) {
+        return;
+    }
+    if (!wait && pending_merge_.wait_for(chrono::seconds(0)) != future_status::ready) {
+        return;
+    }
+    auto merged = pending_merge_.get();
+    const int end_ordinal = segments_[pending_merge_end_ - 1]->GetEndOrdinal();
+    segments_.erase(segments_.begin() + pending_merge_begin_ + 1, segments_.begin() + pending_merge_end_);
+    segments_[pending_merge_begin_] = move(merged);
+    if (pending_merge_ordinals_) {
+        RenumberOrdinals(*pending_merge_ordinals_, segments_[pending_merge_begin_]->GetFirstOrdinal(), end_ordinal);
+        pending_merge_ordinals_.reset();
+    }
+    MaybeStartMerge();
+}
@@ -12,15 +12,49 @@
 #include <execution>
 #include <functional>
 #include <future>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <memory_resource>
+#include <thread>
+#include <mutex>
+#include <optional>
+#include <limits>
 
 #include "document.h"
 #include "string_processing.h"
-#include "concurrent_map.h"
+#include "query_arena.h"
 #include "log_duration.h"
+#include "search_metrics.h"
+#include "query_profile.h"
+#include "search_cursor.h"
+#include "index_segment.h"
+#include "term_dictionary.h"
+#include "scoring_kernel.h"
+#include "memory_usage.h"
+#include "content_store.h"
 
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
 const double RELEVANCE_COMPARISON_ERR = 1e-6;
 
+bool IsRankedHigher(const Document& lhs, const Document& rhs);
+
+// Execution policy tag: the server estimates the cost of each call and runs it
+// sequentially or in parallel, whichever side of the calibrated crossover it is on.
+struct AutoPolicy {};
+inline constexpr AutoPolicy auto_policy{};
+
+// Where the auto policy switches to parallel execution: queries whose plus words
+// have at least `query_postings` postings, and matches or removals touching at
+// least `words` words. numeric_limits<size_t>::max() means never.
+struct AutoPolicyThresholds {
+    size_t query_postings = 0;
+    size_t words = 0;
+};
 
 class SearchServer {
 public:
@@ -28,8 +62,11 @@ public:
     explicit SearchServer(const StringContainer& stop_words);
     explicit SearchServer(const std::string& stop_words_text);
     explicit SearchServer(std::string_view stop_words_text);
+    ~SearchServer();
 
     void AddDocument(int document_id, const std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    // Adds every valid document of the batch in order and reports the rest instead of throwing.
+    std::vector<RejectedDocument> AddDocuments(const std::vector<DocumentRecord>& documents);
 
     template <typename DocumentPredicate>
     std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate) const;
@@ -37,13 +74,66 @@ public:
     std::vector<Document> FindTopDocuments(std::execution::sequenced_policy, std::string_view raw_query, DocumentPredicate document_predicate) const; 
     template <typename DocumentPredicate>
     std::vector<Document> FindTopDocuments(std::execution::parallel_policy ex_policy, std::string_view raw_query, DocumentPredicate document_predicate) const;
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(AutoPolicy, std::string_view raw_query, DocumentPredicate document_predicate) const;
 
     std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status) const;
     std::vector<Document> FindTopDocuments(std::execution::sequenced_policy ex_policy, std::string_view raw_query, DocumentStatus status) const;
     std::vector<Document> FindTopDocuments(std::execution::parallel_policy ex_policy, std::string_view raw_query, DocumentStatus status) const;
+    std::vector<Document> FindTopDocuments(AutoPolicy, std::string_view raw_query, DocumentStatus status) const;
     std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
     std::vector<Document> FindTopDocuments(std::execution::sequenced_policy ex_policy, std::string_view raw_query) const;
     std::vector<Document> FindTopDocuments(std::execution::parallel_policy ex_policy, std::string_view raw_query) const;
+    std::vector<Document> FindTopDocuments(AutoPolicy, std::string_view raw_query) const;
+
+    // With ALL_WORDS only documents holding every plus word are returned, and a query
+    // costs about as much as the posting list of its rarest word. A `word*` plus word
+    // is held by a document holding any term it expands to; one that expands to
+    // nothing matches no document.
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(QueryMode mode, std::string_view raw_query, DocumentPredicate document_predicate) const;
+    std::vector<Document> FindTopDocuments(QueryMode mode, std::string_view raw_query, DocumentStatus status) const;
+    std::vector<Document> FindTopDocuments(QueryMode mode, std::string_view raw_query) const;
+
+    // Search-after pagination: returns the page that follows the cursor and the cursor
+    // for the page after it. With a DocumentStatus the ranked candidates are cached
+    // for a short while, and following pages are sliced from that snapshot even if
+    // the index changes meanwhile. A custom predicate cannot be told apart from
+    // another, so its pages are re-ranked on every call and resume after the last
+    // document returned. Throws invalid_argument for a page_size of zero.
+    template <typename DocumentPredicate>
+    SearchPage FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate, const SearchCursor& cursor, size_t page_size = MAX_RESULT_DOCUMENT_COUNT) const;
+    SearchPage FindTopDocuments(std::string_view raw_query, DocumentStatus status, const SearchCursor& cursor, size_t page_size = MAX_RESULT_DOCUMENT_COUNT) const;
+    SearchPage FindTopDocuments(std::string_view raw_query, const SearchCursor& cursor, size_t page_size = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    // Sharding support: GetCollectionStats reports the local document frequency of
+    // every plus word of the query; a coordinator sums them over all shards and
+    // passes the result back, so every shard ranks with the same IDF.
+    CollectionStats GetCollectionStats(std::string_view raw_query) const;
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate, const CollectionStats& collection_stats) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status, const CollectionStats& collection_stats) const;
+
+    template <typename DocumentPredicate>
+    ProfiledDocuments FindTopDocumentsWithProfile(std::string_view raw_query, DocumentPredicate document_predicate) const;
+    template <typename DocumentPredicate>
+    ProfiledDocuments FindTopDocumentsWithProfile(std::execution::sequenced_policy, std::string_view raw_query, DocumentPredicate document_predicate) const;
+    template <typename DocumentPredicate>
+    ProfiledDocuments FindTopDocumentsWithProfile(std::execution::parallel_policy, std::string_view raw_query, DocumentPredicate document_predicate) const;
+    ProfiledDocuments FindTopDocumentsWithProfile(std::string_view raw_query, DocumentStatus status) const;
+    ProfiledDocuments FindTopDocumentsWithProfile(std::string_view raw_query) const;
+
+    // Runs the query on its own thread. Scoring stops once the budget is spent and the
+    // best documents found so far come back flagged as partial. Throws invalid_argument
+    // for a malformed query and runtime_error when too many queries are in flight.
+    template <typename DocumentPredicate>
+    std::future<SearchResult> FindTopDocumentsAsync(std::string_view raw_query, DocumentPredicate document_predicate, std::chrono::steady_clock::duration budget) const;
+    template <typename DocumentPredicate, typename Callback>
+    void FindTopDocumentsAsync(std::string_view raw_query, DocumentPredicate document_predicate, std::chrono::steady_clock::duration budget, Callback on_complete) const;
+    std::future<SearchResult> FindTopDocumentsAsync(std::string_view raw_query, std::chrono::steady_clock::duration budget) const;
+
+    void SetMaxInFlightQueries(size_t max_queries);
+    size_t GetInFlightQueries() const;
 
     int GetDocumentCount() const;
 
@@ -53,40 +143,154 @@ public:
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::string_view raw_query, int document_id) const;
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::execution::sequenced_policy ex_policy, const std::string_view raw_query, int document_id) const;
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::execution::parallel_policy ex_policy, const std::string_view raw_query, int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(AutoPolicy, std::string_view raw_query, int document_id) const;
 
+    // Built from the index on every call; the reference stays valid until the next one.
     const std::map<std::string_view, double>& GetWordFrequencies(int document_id);
     
     void RemoveDocument(int document_id);
     void RemoveDocument(std::execution::sequenced_policy ex_policy, int document_id);
     void RemoveDocument(std::execution::parallel_policy ex_policy, int document_id);
+    void RemoveDocument(AutoPolicy, int document_id);
 
+    // Times sequential against parallel execution on the current index and moves the
+    // auto policy's crossover points to where parallel starts winning on this host.
+    // Run it once the index holds a representative collection; the timed queries
+    // show up in the metrics like any other. Impact ordering is off while timing,
+    // since it takes the same path under both policies.
+    AutoPolicyThresholds CalibrateAutoPolicy();
+    void SetAutoPolicyThresholds(const AutoPolicyThresholds& thresholds);
+    AutoPolicyThresholds GetAutoPolicyThresholds() const;
 
-private:
+    MetricsSnapshot GetMetrics() const;
+    // Metrics are recorded unless disabled here; GetMetrics then stops advancing.
+    void EnableMetrics(bool enabled);
 
-    struct DocumentData {
-        int rating;
-        DocumentStatus status;
-        std::string content;
-    };
+    // New documents collect in a small mutable segment that is frozen into an
+    // immutable one every `documents` additions. Runs of SEGMENT_MERGE_FACTOR
+    // segments of the same level are merged, and the prefix trie is rebuilt, on
+    // background threads; WaitForMerges installs both.
+    void SetSegmentFlushThreshold(size_t documents);
+    void WaitForMerges();
+    size_t GetSegmentCount() const;
+
+    // Keeps a second copy of every posting list ordered by term frequency. Queries
+    // with at most MAX_IMPACT_QUERY_WORDS plus words then read postings best first
+    // and stop as soon as no unread document can enter the top results.
+    void EnableImpactOrdering(bool enabled);
+
+    // FLOAT accumulates relevance in single precision for throughput; DOUBLE (the
+    // default) ranks exactly as before.
+    void SetScoringPrecision(ScoringPrecision precision);
+
+    // Heap bytes held by the index, by category. Containers allocate through counting
+    // resources, so the numbers are exact and cheap to read; document_ids_, a std
+    // vector for the public iterators, is accounted for by its capacity.
+    MemoryUsage GetMemoryUsage() const;
+    // A document is admitted only if current usage plus its text fits in `bytes`;
+    // otherwise AddDocument throws runtime_error and AddDocuments reports it as
+    // rejected. With EVICT_CONTENT resident document text is released first when
+    // that covers the shortfall; text already on disk is not counted as resident.
+    void SetMemoryBudget(size_t bytes, MemoryBudgetPolicy policy = MemoryBudgetPolicy::REJECT);
+
+    // Document text lives in a compressed on-disk ContentStore and is read back on
+    // demand; the index never refers to it. Throws out_of_range for an unknown id.
+    std::string GetDocumentContent(int document_id) const;
+    void SetContentCacheCapacity(size_t blocks);
+
+private:
 
     struct QueryWord {
         std::string_view data;
         bool is_minus;
         bool is_stop;
+        bool is_prefix;
     };
 
     struct Query {
-        std::vector<std::string_view> plus_words;
-        std::vector<std::string_view> minus_words;
+        explicit Query(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+            : plus_words(resource)
+            , minus_words(resource)
+            , plus_groups(resource) {
+        }
+
+        std::pmr::vector<std::string_view> plus_words;
+        std::pmr::vector<std::string_view> minus_words;
+        // One group per plus word of the query text: the word itself, or the terms a
+        // prefix word expanded to. ALL_WORDS needs one term of every group.
+        std::pmr::vector<std::pmr::vector<std::string_view>> plus_groups;
     };
 
-    const std::set<std::string, std::less<>> stop_words_;
-    std::map<std::string_view, std::map<int, double>> word_to_document_freqs_;
-    std::map<int, std::map<std::string_view, double>> document_to_word_freqs_;
-    std::map<int, DocumentData> documents_;
+    static constexpr size_t MAX_IMPACT_QUERY_WORDS = 3;
+    static constexpr size_t DEFAULT_SEGMENT_FLUSH_THRESHOLD = 1024;
+    static constexpr size_t SEGMENT_MERGE_FACTOR = 4;
+    // A merge renumbers the ordinals it covers, reclaiming removed documents' slots, once
+    // at least 1/ORDINAL_COMPACTION_FACTOR of them are dead; a segment that sparse is
+    // rewritten even when it has no run to merge with.
+    static constexpr size_t ORDINAL_COMPACTION_FACTOR = 4;
+    // A `word*` query word stands for at most this many terms.
+    static constexpr size_t MAX_PREFIX_EXPANSIONS = 1024;
+    // A segment flush starts a background rebuild of the term trie once the terms added
+    // since the last build reach 1/TERM_TRIE_REBUILD_FACTOR of the terms it holds.
+    static constexpr size_t TERM_TRIE_REBUILD_FACTOR = 8;
+
+    // One counting resource per MemoryCategory. Declared first, so the containers
+    // below are destroyed before the resources they allocate from.
+    std::array<CountingResource, MEMORY_CATEGORY_COUNT> memory_resources_;
+    size_t memory_budget_ = UNLIMITED_MEMORY;
+    MemoryBudgetPolicy memory_budget_policy_ = MemoryBudgetPolicy::REJECT;
+
+    std::pmr::memory_resource* MemoryResource(MemoryCategory category) {
+        return &memory_resources_[static_cast<size_t>(category)];
+    }
+
+    const StopWordSet stop_words_;
+    // Terms are interned once, so index keys never point into document content.
+    // document_freqs_[term_id] counts the live documents containing the term.
+    TermDictionary term_dictionary_{ MemoryResource(MemoryCategory::TERM_DICTIONARY) };
+    std::pmr::vector<int> document_freqs_{ MemoryResource(MemoryCategory::TERM_DICTIONARY) };
+    // Prefix lookups go to the trie and to recent_terms_, the (term, term_id) pairs it
+    // does not cover yet, sorted by term.
+    TermTrie term_trie_{ MemoryResource(MemoryCategory::TERM_DICTIONARY) };
+    std::pmr::vector<std::pair<std::string_view, int>> recent_terms_{ MemoryResource(MemoryCategory::TERM_DICTIONARY) };
+    // Postings and per-document data are keyed by a dense internal ordinal assigned
+    // in insertion order; the document_* columns below are indexed by it. The
+    // immutable segments cover consecutive ordinal ranges and the mutable segment
+    // holds the newest documents. Removed documents stay in the segments and in the
+    // columns as tombstones until a merge drops them; a compacting merge also gives
+    // their ordinals back (see ORDINAL_COMPACTION_FACTOR).
+    std::pmr::vector<std::shared_ptr<const IndexSegment>> segments_{ MemoryResource(MemoryCategory::POSTINGS) };
+    MutableSegment mutable_segment_{ MemoryResource(MemoryCategory::POSTINGS) };
+    size_t segment_flush_threshold_ = DEFAULT_SEGMENT_FLUSH_THRESHOLD;
+    std::pmr::vector<char> document_alive_{ MemoryResource(MemoryCategory::DOCUMENT_TABLE) };
+    // document_term_freqs_[ordinal] holds (term_id, term_freq) pairs sorted by term id.
+    std::pmr::vector<std::pmr::vector<std::pair<int, double>>> document_term_freqs_{ MemoryResource(MemoryCategory::WORD_FREQS) };
+    // Backs the reference GetWordFrequencies returns.
+    std::map<std::string_view, double> word_frequencies_;
+    ScoringPrecision scoring_precision_ = ScoringPrecision::DOUBLE;
+    bool impact_ordering_enabled_ = false;
+    // impact_postings_[term_id] holds (term_freq, ordinal) of live documents, highest first.
+    std::pmr::vector<std::pmr::set<std::pair<double, int>, std::greater<>>> impact_postings_{ MemoryResource(MemoryCategory::POSTINGS) };
+    std::pmr::vector<int> document_ratings_{ MemoryResource(MemoryCategory::DOCUMENT_TABLE) };
+    std::pmr::vector<DocumentStatus> document_statuses_{ MemoryResource(MemoryCategory::DOCUMENT_TABLE) };
+    std::pmr::vector<int> document_external_ids_{ MemoryResource(MemoryCategory::DOCUMENT_TABLE) };
+    ContentStore document_contents_{ MemoryResource(MemoryCategory::DOCUMENT_CONTENT) };
+    std::pmr::unordered_map<int, int> document_ordinals_{ MemoryResource(MemoryCategory::DOCUMENT_TABLE) };
     std::vector<int> document_ids_;
+    mutable ScoreAccumulatorPool score_accumulators_{ MemoryResource(MemoryCategory::SCORE_ACCUMULATORS) };
+    mutable SearchMetrics metrics_;
+    std::future<std::shared_ptr<const IndexSegment>> pending_merge_;
+    size_t pending_merge_begin_ = 0;
+    size_t pending_merge_end_ = 0;
+    // Set when the pending merge renumbers: the new ordinal (or -1) of every ordinal it covers.
+    std::shared_ptr<const std::vector<int>> pending_merge_ordinals_;
+    std::future<TermTrie> pending_term_trie_;
 
     bool IsStopWord(std::string_view word) const;
+    std::vector<std::pair<std::string_view, double>> ComputeWordFreqs(std::string_view document) const;
+    bool FitsMemoryBudget(size_t document_size);
+    void CommitDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings,
+        const std::vector<std::pair<std::string_view, double>>& content_word_freqs);
 
     static bool IsValidWord(std::string_view word);
 
@@ -94,27 +298,161 @@ private:
 
     static int ComputeAverageRating(const std::vector<int>& ratings);
 
+    int GetOrdinal(int document_id) const;
+    const double* FindTermFreq(int ordinal, int term_id) const;
+    void ReleaseOrdinal(int document_id, int ordinal);
+
     QueryWord ParseQueryWord(std::string_view text) const;
-    Query ParseQuery(std::string_view text, bool skip_sort = false) const;
+    Query ParseQuery(std::string_view text, bool skip_sort = false, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) const;
+    void ExpandPrefix(std::string_view prefix, std::pmr::vector<std::string_view>& words) const;
+
+    int GetDocumentFreq(int term_id) const;
 
-    double ComputeWordInverseDocumentFreq(const std::string_view& word) const;
+    template <typename Func>
+    void ForEachPostingList(int term_id, Func func) const;
 
+    void FlushMutableSegment();
+    void MaybeStartTermTrieBuild();
+    void InstallTermTrie(bool wait);
+    void MaybeStartMerge();
+    void InstallFinishedMerge(bool wait);
+    void RenumberOrdinals(const std::vector<int>& new_ordinals, int first_ordinal, int end_ordinal);
+
+    struct QueryContext {
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource();
+        QueryProfile* profile = nullptr;
+        std::optional<std::chrono::steady_clock::time_point> deadline;
+        std::atomic<bool> budget_exhausted{ false };
+        const CollectionStats* collection_stats = nullptr;
+        QueryMode mode = QueryMode::ANY_WORDS;
+
+        bool IsOutOfBudget() {
+            if (!deadline) {
+                return false;
+            }
+            if (budget_exhausted.load(std::memory_order_relaxed)) {
+                return true;
+            }
+            if (std::chrono::steady_clock::now() >= *deadline) {
+                budget_exhausted.store(true, std::memory_order_relaxed);
+                return true;
+            }
+            return false;
+        }
+    };
+
+    double ComputeWordInverseDocumentFreq(std::string_view word, int document_freq, const QueryContext& context) const;
+
+    class QuerySlot {
+    public:
+        explicit QuerySlot(const SearchServer& server);
+        QuerySlot(const QuerySlot&) = delete;
+        QuerySlot& operator=(const QuerySlot&) = delete;
+        ~QuerySlot();
+
+    private:
+        const SearchServer& server_;
+    };
+
+    struct AsyncQuery {
+        explicit AsyncQuery(const SearchServer& server)
+            : slot(server) {
+        }
+
+        QuerySlot slot;
+        std::string text;
+        Query query;
+        QueryContext context;
+    };
+
+    static constexpr size_t POSTING_BLOCK_SIZE = 1024;
+    // Below this many postings per worker, starting a thread costs more than it saves.
+    static constexpr size_t MIN_POSTINGS_PER_WORKER = 16 * 1024;
+    static constexpr size_t DEFAULT_MAX_IN_FLIGHT_QUERIES = 64;
+    static constexpr AutoPolicyThresholds DEFAULT_AUTO_POLICY_THRESHOLDS{ 2 * MIN_POSTINGS_PER_WORKER, 1024 };
+
+    AutoPolicyThresholds auto_policy_thresholds_ = DEFAULT_AUTO_POLICY_THRESHOLDS;
+
+    size_t EstimatePostingVolume(const Query& query) const;
+
+    mutable std::mutex async_mutex_;
+    mutable std::condition_variable async_done_;
+    mutable size_t in_flight_queries_ = 0;
+    size_t max_in_flight_queries_ = DEFAULT_MAX_IN_FLIGHT_QUERIES;
+
+    struct CachedCandidates {
+        uint64_t token = 0;
+        std::string raw_query;
+        DocumentStatus status = DocumentStatus::ACTUAL;
+        std::chrono::steady_clock::time_point expires_at;
+        std::vector<Document> ranked;
+    };
+
+    static constexpr size_t CURSOR_CACHE_CAPACITY = 16;
+    static constexpr std::chrono::seconds CURSOR_CACHE_TTL{ 60 };
+
+    mutable std::mutex cursor_cache_mutex_;
+    mutable std::deque<std::shared_ptr<const CachedCandidates>> cursor_cache_;
+    mutable uint64_t next_cursor_token_ = 0;
+
+    // `status` is the cache key beside the query text; without one nothing is cached.
     template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(std::execution::sequenced_policy, const Query& query, DocumentPredicate document_predicate) const; 
+    SearchPage FindPage(std::string_view raw_query, DocumentPredicate document_predicate, std::optional<DocumentStatus> status,
+        const SearchCursor& cursor, size_t page_size) const;
+    std::optional<SearchPage> FindCachedPage(std::string_view raw_query, DocumentStatus status, const SearchCursor& cursor, size_t page_size) const;
+    SearchPage CacheRankedDocuments(std::string_view raw_query, std::optional<DocumentStatus> status, std::vector<Document> ranked,
+        const SearchCursor& cursor, size_t page_size) const;
+    static SearchPage MakePage(const CachedCandidates& candidates, size_t offset, size_t page_size);
+
+    std::unique_ptr<AsyncQuery> StartAsyncQuery(std::string_view raw_query, std::chrono::steady_clock::duration budget) const;
     template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(std::execution::parallel_policy ex_policy, const Query& query, DocumentPredicate document_predicate) const; 
+    SearchResult CompleteAsyncQuery(AsyncQuery& request, DocumentPredicate document_predicate) const;
+
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocumentsImpl(ExecutionPolicy ex_policy, std::string_view raw_query, DocumentPredicate document_predicate, QueryContext& context) const;
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> RankDocuments(ExecutionPolicy ex_policy, const Query& query, DocumentPredicate document_predicate, QueryContext& context) const;
+    template <typename DocumentPredicate>
+    std::vector<Document> RankDocuments(AutoPolicy, const Query& query, DocumentPredicate document_predicate, QueryContext& context) const;
+
+    template <typename DocumentPredicate>
+    std::pmr::vector<Document> FindTopDocumentsByImpact(const Query& query, DocumentPredicate document_predicate, QueryContext& context) const;
+    void AddImpactPostings(int ordinal);
+    void RemoveImpactPosting(int term_id, double term_freq, int ordinal);
+
+    template <typename DocumentPredicate>
+    std::pmr::vector<Document> FindAllDocuments(std::execution::sequenced_policy, const Query& query, DocumentPredicate document_predicate, QueryContext& context) const; 
+    template <typename DocumentPredicate>
+    std::pmr::vector<Document> FindAllDocuments(std::execution::parallel_policy ex_policy, const Query& query, DocumentPredicate document_predicate, QueryContext& context) const; 
+    template <typename DocumentPredicate>
+    std::pmr::vector<Document> FindAllDocumentsConjunctive(const Query& query, DocumentPredicate document_predicate, QueryContext& context) const;
     
+    // One posting list of one plus word, the unit the parallel scan is planned over.
+    struct ScanTask {
+        size_t term_index;
+        double inverse_document_freq;
+        PostingList postings;
+    };
+
+    static size_t ChooseWorkerCount(size_t total_postings);
+    static std::pmr::vector<int> PartitionOrdinals(const std::pmr::vector<ScanTask>& tasks, size_t total_postings,
+        size_t worker_count, int end_ordinal, std::pmr::memory_resource* resource);
+
+    template <typename DocumentPredicate>
+    size_t ScorePostings(const int* ordinals, const double* term_freqs, size_t count, double inverse_document_freq,
+        DocumentPredicate document_predicate, ScoreAccumulator& accumulator, TermProfile* term_stats, QueryContext& context) const;
     template <typename DocumentPredicate>
-    void FindAllDocumentsConcurrent(const std::string_view& word, DocumentPredicate document_predicate, ConcurrentMap<int, double>& document_to_relevance) const;
+    size_t ScanOrdinalRange(const std::pmr::vector<ScanTask>& tasks, int begin, int end, DocumentPredicate document_predicate,
+        std::pmr::vector<std::pair<int, double>>& documents, TermProfile* term_stats, QueryContext& context) const;
 };
 
 
 template <typename StringContainer>
 SearchServer::SearchServer(const StringContainer& stop_words)
-    : stop_words_(MakeUniqueNonEmptyStrings(stop_words))
+    : stop_words_(MakeUniqueNonEmptyStrings(stop_words), MemoryResource(MemoryCategory::STOP_WORDS))
 {
     using namespace std::string_literals;
-    if (!all_of(stop_words_.begin(), stop_words_.end(), IsValidWord)) {
+    if (!all_of(stop_words.begin(), stop_words.end(), IsValidWord)) {
         throw std::invalid_argument("Some of stop words are invalid"s);
     }
 }
@@ -126,130 +464,673 @@ std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query,
 
 template <typename DocumentPredicate>
 std::vector<Document> SearchServer::FindTopDocuments(std::execution::sequenced_policy, std::string_view raw_query, DocumentPredicate document_predicate) const {
-    const Query query = ParseQuery(raw_query);
+    QueryContext context;
+    return FindTopDocumentsImpl(std::execution::seq, raw_query, document_predicate, context);
+}
 
-    auto matched_documents = FindAllDocuments(std::execution::seq, query, document_predicate);
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(std::execution::parallel_policy ex_policy, std::string_view raw_query, DocumentPredicate document_predicate) const {
+    QueryContext context;
+    return FindTopDocumentsImpl(std::execution::par, raw_query, document_predicate, context);
+}
 
-    sort(matched_documents.begin(), matched_documents.end(), [](const Document& lhs, const Document& rhs) {
-        if (std::abs(lhs.relevance - rhs.relevance) < RELEVANCE_COMPARISON_ERR) {
-            return lhs.rating > rhs.rating;
-        }
-        else {
-            return lhs.relevance > rhs.relevance;
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(AutoPolicy, std::string_view raw_query, DocumentPredicate document_predicate) const {
+    QueryContext context;
+    return FindTopDocumentsImpl(auto_policy, raw_query, document_predicate, context);
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(QueryMode mode, std::string_view raw_query, DocumentPredicate document_predicate) const {
+    QueryContext context;
+    context.mode = mode;
+    return FindTopDocumentsImpl(std::execution::seq, raw_query, document_predicate, context);
+}
+
+template <typename DocumentPredicate>
+SearchPage SearchServer::FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate, const SearchCursor& cursor, size_t page_size) const {
+    return FindPage(raw_query, document_predicate, std::nullopt, cursor, page_size);
+}
+
+template <typename DocumentPredicate>
+SearchPage SearchServer::FindPage(std::string_view raw_query, DocumentPredicate document_predicate, std::optional<DocumentStatus> status,
+    const SearchCursor& cursor, size_t page_size) const {
+    if (page_size == 0) {
+        throw std::invalid_argument("Page size must be positive");
+    }
+    StageTimer query_timer(metrics_, SearchStage::QUERY);
+    if (cursor.IsEnd()) {
+        return SearchPage{ {}, cursor };
+    }
+    if (status) {
+        if (auto page = FindCachedPage(raw_query, *status, cursor, page_size)) {
+            return std::move(*page);
         }
-        });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
     }
 
-    return matched_documents;
+    QueryArena::Scope arena_scope;
+    QueryContext context;
+    context.resource = arena_scope.Resource();
+    Query query(context.resource);
+    {
+        StageTimer parse_timer(metrics_, SearchStage::PARSE);
+        query = ParseQuery(raw_query, false, context.resource);
+    }
+    auto matched_documents = FindAllDocuments(std::execution::seq, query, document_predicate, context);
+    {
+        StageTimer top_k_timer(metrics_, SearchStage::TOP_K);
+        sort(matched_documents.begin(), matched_documents.end(), IsRankedHigher);
+    }
+    return CacheRankedDocuments(raw_query, status, std::vector<Document>(matched_documents.begin(), matched_documents.end()), cursor, page_size);
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(std::execution::parallel_policy ex_policy, std::string_view raw_query, DocumentPredicate document_predicate) const {
-    const Query query = ParseQuery(raw_query);
-    auto matched_documents = FindAllDocuments(std::execution::par, query, document_predicate);
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate, const CollectionStats& collection_stats) const {
+    QueryContext context;
+    context.collection_stats = &collection_stats;
+    return FindTopDocumentsImpl(std::execution::seq, raw_query, document_predicate, context);
+}
 
-    sort(matched_documents.begin(), matched_documents.end(), [](const Document& lhs, const Document& rhs) {
-        if (std::abs(lhs.relevance - rhs.relevance) < RELEVANCE_COMPARISON_ERR) {
-            return lhs.rating > rhs.rating;
-        }
-        else {
-            return lhs.relevance > rhs.relevance;
-        }
-        });
+template <typename DocumentPredicate>
+ProfiledDocuments SearchServer::FindTopDocumentsWithProfile(std::string_view raw_query, DocumentPredicate document_predicate) const {
+    return FindTopDocumentsWithProfile(std::execution::seq, raw_query, document_predicate);
+}
+
+template <typename DocumentPredicate>
+ProfiledDocuments SearchServer::FindTopDocumentsWithProfile(std::execution::sequenced_policy, std::string_view raw_query, DocumentPredicate document_predicate) const {
+    ProfiledDocuments result;
+    QueryContext context;
+    context.profile = &result.profile;
+    result.documents = FindTopDocumentsImpl(std::execution::seq, raw_query, document_predicate, context);
+    return result;
+}
+
+template <typename DocumentPredicate>
+ProfiledDocuments SearchServer::FindTopDocumentsWithProfile(std::execution::parallel_policy, std::string_view raw_query, DocumentPredicate document_predicate) const {
+    ProfiledDocuments result;
+    QueryContext context;
+    context.profile = &result.profile;
+    result.documents = FindTopDocumentsImpl(std::execution::par, raw_query, document_predicate, context);
+    return result;
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocumentsImpl(ExecutionPolicy ex_policy, std::string_view raw_query, DocumentPredicate document_predicate, QueryContext& context) const {
+    QueryArena::Scope arena_scope;
+    context.resource = arena_scope.Resource();
+    QueryProfile* const profile = context.profile;
+    StageTimer query_timer(metrics_, SearchStage::QUERY, profile ? &profile->total_time : nullptr);
+    Query query(context.resource);
+    {
+        StageTimer parse_timer(metrics_, SearchStage::PARSE, profile ? &profile->parse_time : nullptr);
+        query = ParseQuery(raw_query, false, context.resource);
+    }
+    return RankDocuments(ex_policy, query, document_predicate, context);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::RankDocuments(ExecutionPolicy ex_policy, const Query& query, DocumentPredicate document_predicate, QueryContext& context) const {
+    if (impact_ordering_enabled_ && context.mode == QueryMode::ANY_WORDS && !context.profile
+        && !query.plus_words.empty() && query.plus_words.size() <= MAX_IMPACT_QUERY_WORDS) {
+        const auto top_documents = FindTopDocumentsByImpact(query, document_predicate, context);
+        return std::vector<Document>(top_documents.begin(), top_documents.end());
+    }
+    auto matched_documents = context.mode == QueryMode::ALL_WORDS
+        ? FindAllDocumentsConjunctive(query, document_predicate, context)
+        : FindAllDocuments(ex_policy, query, document_predicate, context);
 
+    StageTimer top_k_timer(metrics_, SearchStage::TOP_K, context.profile ? &context.profile->top_k_time : nullptr);
+    sort(matched_documents.begin(), matched_documents.end(), IsRankedHigher);
     if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
         matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
     }
 
-    return matched_documents;
+    return std::vector<Document>(matched_documents.begin(), matched_documents.end());
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(std::execution::sequenced_policy, const Query& query, DocumentPredicate document_predicate) const {
-    std::map<int, double> document_to_relevance;
-    for (const std::string_view& word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
+std::vector<Document> SearchServer::RankDocuments(AutoPolicy, const Query& query, DocumentPredicate document_predicate, QueryContext& context) const {
+    if (EstimatePostingVolume(query) >= auto_policy_thresholds_.query_postings) {
+        return RankDocuments(std::execution::par, query, document_predicate, context);
+    }
+    return RankDocuments(std::execution::seq, query, document_predicate, context);
+}
+
+template <typename DocumentPredicate>
+std::future<SearchResult> SearchServer::FindTopDocumentsAsync(std::string_view raw_query, DocumentPredicate document_predicate, std::chrono::steady_clock::duration budget) const {
+    auto request = StartAsyncQuery(raw_query, budget);
+    return std::async(std::launch::async, [this, request = std::move(request), document_predicate]() mutable {
+        const auto finished_request = std::move(request);
+        return CompleteAsyncQuery(*finished_request, document_predicate);
+        });
+}
+
+template <typename DocumentPredicate, typename Callback>
+void SearchServer::FindTopDocumentsAsync(std::string_view raw_query, DocumentPredicate document_predicate, std::chrono::steady_clock::duration budget, Callback on_complete) const {
+    auto request = StartAsyncQuery(raw_query, budget);
+    std::thread([this, request = std::move(request), document_predicate, on_complete = std::move(on_complete)]() mutable {
+        const auto finished_request = std::move(request);
+        on_complete(CompleteAsyncQuery(*finished_request, document_predicate));
+        }).detach();
+}
+
+template <typename DocumentPredicate>
+SearchResult SearchServer::CompleteAsyncQuery(AsyncQuery& request, DocumentPredicate document_predicate) const {
+    QueryArena::Scope arena_scope;
+    request.context.resource = arena_scope.Resource();
+    StageTimer query_timer(metrics_, SearchStage::QUERY);
+    SearchResult result;
+    result.documents = RankDocuments(std::execution::seq, request.query, document_predicate, request.context);
+    result.partial = request.context.budget_exhausted.load(std::memory_order_relaxed);
+    return result;
+}
+
+// Threshold algorithm over the impact-ordered lists: documents are scored in full
+// when first seen, and the scan ends once even a document at the head of every
+// remaining list would rank below the current last result.
+template <typename DocumentPredicate>
+std::pmr::vector<Document> SearchServer::FindTopDocumentsByImpact(const Query& query, DocumentPredicate document_predicate, QueryContext& context) const {
+    using ImpactIterator = decltype(impact_postings_)::value_type::const_iterator;
+    struct Cursor {
+        int term_id;
+        double inverse_document_freq;
+        ImpactIterator it;
+        ImpactIterator end;
+    };
+
+    std::pmr::vector<Cursor> cursors(context.resource);
+    for (const std::string_view word : query.plus_words) {
+        const int term_id = term_dictionary_.Find(word);
+        const int document_freq = GetDocumentFreq(term_id);
+        if (document_freq > 0) {
+            const auto& postings = impact_postings_[term_id];
+            cursors.push_back({ term_id, ComputeWordInverseDocumentFreq(word, document_freq, context), postings.begin(), postings.end() });
+        }
+    }
+    std::pmr::vector<int> minus_term_ids(context.resource);
+    for (const std::string_view word : query.minus_words) {
+        minus_term_ids.push_back(term_dictionary_.Find(word));
+    }
+
+    StageTimer scan_timer(metrics_, SearchStage::POSTING_SCAN);
+    std::pmr::vector<Document> top_documents(context.resource);
+    std::pmr::unordered_set<int> seen(context.resource);
+    size_t postings_scanned = 0;
+    size_t documents_scored = 0;
+    const auto score = [&](int ordinal) {
+        if (!document_predicate(document_external_ids_[ordinal], document_statuses_[ordinal], document_ratings_[ordinal])) {
+            return;
+        }
+        for (const int term_id : minus_term_ids) {
+            if (FindTermFreq(ordinal, term_id)) {
+                return;
+            }
+        }
+        ++documents_scored;
+        // Same summation order as FindAllDocuments, so relevance is bit-identical.
+        double relevance = 0.0;
+        for (const Cursor& cursor : cursors) {
+            if (const double* term_freq = FindTermFreq(ordinal, cursor.term_id)) {
+                relevance += *term_freq * cursor.inverse_document_freq;
+            }
+        }
+        const Document document{ document_external_ids_[ordinal], relevance, document_ratings_[ordinal] };
+        if (top_documents.size() == MAX_RESULT_DOCUMENT_COUNT && !IsRankedHigher(document, top_documents.back())) {
+            return;
+        }
+        top_documents.insert(std::upper_bound(top_documents.begin(), top_documents.end(), document, IsRankedHigher), document);
+        if (top_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
+            top_documents.pop_back();
+        }
+    };
+
+    while (true) {
+        double threshold = 0.0;
+        bool exhausted = true;
+        for (const Cursor& cursor : cursors) {
+            if (cursor.it != cursor.end) {
+                threshold += cursor.it->first * cursor.inverse_document_freq;
+                exhausted = false;
+            }
+        }
+        if (exhausted || (top_documents.size() == MAX_RESULT_DOCUMENT_COUNT
+            && threshold < top_documents.back().relevance - RELEVANCE_COMPARISON_ERR)) {
+            break;
+        }
+        if ((postings_scanned & (POSTING_BLOCK_SIZE - 1)) == 0 && context.IsOutOfBudget()) {
+            break;
         }
-        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-        for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-            const auto& document_data = documents_.at(document_id);
-            if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                document_to_relevance[document_id] += term_freq * inverse_document_freq;
+        for (Cursor& cursor : cursors) {
+            if (cursor.it == cursor.end) {
+                continue;
+            }
+            const int ordinal = cursor.it->second;
+            ++cursor.it;
+            ++postings_scanned;
+            if (seen.insert(ordinal).second) {
+                score(ordinal);
             }
         }
     }
+    metrics_.RecordQuery(postings_scanned, documents_scored);
+    return top_documents;
+}
 
-    for (const std::string_view& word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
+template <typename DocumentPredicate>
+std::pmr::vector<Document> SearchServer::FindAllDocuments(std::execution::sequenced_policy, const Query& query, DocumentPredicate document_predicate, QueryContext& context) const {
+    QueryProfile* const profile = context.profile;
+    const auto lease = score_accumulators_.Acquire();
+    ScoreAccumulator& accumulator = *lease;
+    accumulator.Start(0, static_cast<int>(document_alive_.size()), scoring_precision_);
+    size_t postings_scanned = 0;
+    {
+        StageTimer scan_timer(metrics_, SearchStage::POSTING_SCAN, profile ? &profile->scan_time : nullptr);
+        for (const std::string_view& word : query.plus_words) {
+            TermProfile* term_profile = profile ? &profile->AddTerm(word, false) : nullptr;
+            TermTimer term_timer(term_profile);
+            const int term_id = term_dictionary_.Find(word);
+            const int document_freq = GetDocumentFreq(term_id);
+            if (document_freq == 0) {
+                continue;
+            }
+            const double inverse_document_freq = ComputeWordInverseDocumentFreq(word, document_freq, context);
+            size_t posting_length = 0;
+            ForEachPostingList(term_id, [&](const PostingList& postings) {
+                posting_length += postings.size;
+                postings_scanned += ScorePostings(postings.ordinals, postings.term_freqs, postings.size, inverse_document_freq,
+                    document_predicate, accumulator, term_profile, context);
+                });
+            if (term_profile) {
+                term_profile->posting_length = posting_length;
+                term_profile->inverse_document_freq = inverse_document_freq;
+            }
         }
-        for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-            document_to_relevance.erase(document_id);
+    }
+    metrics_.RecordQuery(postings_scanned, accumulator.GetAcceptedCount());
+
+    {
+        StageTimer minus_timer(metrics_, SearchStage::MINUS_FILTER, profile ? &profile->minus_time : nullptr);
+        for (const std::string_view& word : query.minus_words) {
+            TermProfile* term_profile = profile ? &profile->AddTerm(word, true) : nullptr;
+            TermTimer term_timer(term_profile);
+            const int term_id = term_dictionary_.Find(word);
+            if (GetDocumentFreq(term_id) == 0) {
+                continue;
+            }
+            size_t posting_length = 0;
+            size_t eliminated = 0;
+            ForEachPostingList(term_id, [&](const PostingList& postings) {
+                posting_length += postings.size;
+                for (size_t i = 0; i < postings.size; ++i) {
+                    eliminated += accumulator.Discard(postings.ordinals[i]);
+                }
+                });
+            if (term_profile) {
+                term_profile->posting_length = posting_length;
+                term_profile->documents_eliminated = eliminated;
+            }
         }
     }
 
-    std::vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : document_to_relevance) {
-        matched_documents.push_back({ document_id, relevance, documents_.at(document_id).rating });
+    std::pmr::vector<Document> matched_documents(context.resource);
+    matched_documents.reserve(accumulator.GetAcceptedCount());
+    accumulator.ForEachAccepted([&](int ordinal, double relevance) {
+        matched_documents.push_back({ document_external_ids_[ordinal], relevance, document_ratings_[ordinal] });
+        });
+    if (profile) {
+        profile->FinishScan(matched_documents.size());
     }
     return matched_documents;
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(std::execution::parallel_policy, const Query& query, DocumentPredicate document_predicate) const {
-    constexpr size_t TASK_COUNT = 4;
-    constexpr size_t THREAD_COUNT = 100;
-    ConcurrentMap<int, double> document_to_relevance(THREAD_COUNT);
-    std::vector<std::future<void>> futures;
-    size_t part_range_size = query.plus_words.size() / TASK_COUNT;
-    size_t range_teil = query.plus_words.size() % TASK_COUNT;
-    auto end_range = range_teil ? prev(query.plus_words.end(), range_teil) : query.plus_words.end(); 
-
-    if (part_range_size) {
-        for (auto it = query.plus_words.begin(); it != end_range; advance(it, part_range_size)) {
-            futures.push_back(std::async([=, &document_to_relevance]() {
-                for (auto word_it = it; word_it != next(it, part_range_size); ++word_it) {
-                    FindAllDocumentsConcurrent(*word_it, document_predicate, document_to_relevance);
-                }
-                }));
+std::pmr::vector<Document> SearchServer::FindAllDocuments(std::execution::parallel_policy, const Query& query, DocumentPredicate document_predicate, QueryContext& context) const {
+    QueryProfile* const profile = context.profile;
+    std::optional<StageTimer> scan_timer(std::in_place, metrics_, SearchStage::POSTING_SCAN, profile ? &profile->scan_time : nullptr);
+    std::pmr::vector<ScanTask> tasks(context.resource);
+    size_t total_postings = 0;
+    for (size_t term_index = 0; term_index < query.plus_words.size(); ++term_index) {
+        const std::string_view word = query.plus_words[term_index];
+        TermProfile* term_profile = profile ? &profile->AddTerm(word, false) : nullptr;
+        const int term_id = term_dictionary_.Find(word);
+        const int document_freq = GetDocumentFreq(term_id);
+        if (document_freq == 0) {
+            continue;
+        }
+        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word, document_freq, context);
+        ForEachPostingList(term_id, [&](const PostingList& postings) {
+            if (postings.size > 0) {
+                tasks.push_back({ term_index, inverse_document_freq, postings });
+                total_postings += postings.size;
+            }
+            });
+        if (term_profile) {
+            term_profile->inverse_document_freq = inverse_document_freq;
         }
     }
-    if (range_teil) {
-        for (auto word_it = end_range; word_it != query.plus_words.end(); ++word_it) {
-            FindAllDocumentsConcurrent(*word_it, document_predicate, document_to_relevance);
+    if (profile) {
+        for (const ScanTask& task : tasks) {
+            profile->terms[task.term_index].posting_length += task.postings.size;
         }
     }
+
+    // Workers own disjoint ordinal ranges holding about the same number of postings,
+    // so a single long posting list is shared out instead of pinning one worker.
+    const size_t worker_count = ChooseWorkerCount(total_postings);
+    const std::pmr::vector<int> bounds = PartitionOrdinals(tasks, total_postings, worker_count, static_cast<int>(document_alive_.size()), context.resource);
+    SynchronizedResource shared_resource(context.resource);
+    std::pmr::vector<std::pmr::vector<std::pair<int, double>>> parts(worker_count, &shared_resource);
+    std::pmr::vector<TermProfile> term_stats(profile ? worker_count * query.plus_words.size() : 0, context.resource);
+    const auto scan = [&](size_t worker) {
+        return ScanOrdinalRange(tasks, bounds[worker], bounds[worker + 1], document_predicate, parts[worker],
+            profile ? &term_stats[worker * query.plus_words.size()] : nullptr, context);
+    };
+    std::pmr::vector<std::future<size_t>> futures(context.resource);
+    for (size_t worker = 1; worker < worker_count; ++worker) {
+        futures.push_back(std::async(std::launch::async, scan, worker));
+    }
+    size_t postings_scanned = scan(0);
     for (auto& f : futures) {
-        f.get();
+        postings_scanned += f.get();
+    }
+    if (profile) {
+        for (size_t i = 0; i < term_stats.size(); ++i) {
+            TermProfile& term = profile->terms[i % query.plus_words.size()];
+            term.predicate_passed += term_stats[i].predicate_passed;
+            term.predicate_rejected += term_stats[i].predicate_rejected;
+            term.documents_dead += term_stats[i].documents_dead;
+            term.elapsed += term_stats[i].elapsed;
+        }
     }
-    auto result = document_to_relevance.BuildOrdinaryMap();
+
+    std::pmr::map<int, double> result(context.resource);
+    for (const auto& part : parts) {
+        for (const auto& [ordinal, relevance] : part) {
+            result.emplace_hint(result.end(), ordinal, relevance);
+        }
+    }
+    scan_timer.reset();
+    metrics_.RecordQuery(postings_scanned, result.size());
+
+    StageTimer minus_timer(metrics_, SearchStage::MINUS_FILTER, profile ? &profile->minus_time : nullptr);
+    if (profile) {
+        for (const std::string_view& word : query.minus_words) {
+            profile->AddTerm(word, true);
+        }
+    }
+    std::mutex result_mutex;
     for_each(std::execution::par, query.minus_words.begin(), query.minus_words.end(), [&](const auto& word) {
-        if (word_to_document_freqs_.count(word) != 0) {
-            for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-                result.erase(document_id);
+        TermProfile* minus_profile = profile ? &profile->terms[query.plus_words.size() + (&word - query.minus_words.data())] : nullptr;
+        TermTimer term_timer(minus_profile);
+        const int term_id = term_dictionary_.Find(word);
+        if (GetDocumentFreq(term_id) != 0) {
+            size_t posting_length = 0;
+            size_t eliminated = 0;
+            ForEachPostingList(term_id, [&](const PostingList& postings) {
+                posting_length += postings.size;
+                std::lock_guard guard(result_mutex);
+                for (size_t i = 0; i < postings.size; ++i) {
+                    eliminated += result.erase(postings.ordinals[i]);
+                }
+                });
+            if (minus_profile) {
+                minus_profile->posting_length = posting_length;
+                minus_profile->documents_eliminated = eliminated;
             }
         }
         });
-    std::vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : result) {
-        matched_documents.push_back({ document_id, relevance, documents_.at(document_id).rating });
+    std::pmr::vector<Document> matched_documents(context.resource);
+    for (const auto [ordinal, relevance] : result) {
+        matched_documents.push_back({ document_external_ids_[ordinal], relevance, document_ratings_[ordinal] });
+    }
+    if (profile) {
+        profile->FinishScan(matched_documents.size());
     }
 
     return matched_documents;
 }
 
+// Segments cover disjoint ordinal ranges, so each is intersected on its own. Every
+// plus word of the query is a group of terms, more than one for a prefix word, and a
+// document needs a term of each group: the group with the fewest postings leads, its
+// lists merged in ordinal order, and every other list, minus words included, is
+// probed by galloping ahead. Only documents holding all groups reach the predicate
+// and get scored.
 template <typename DocumentPredicate>
-void SearchServer::FindAllDocumentsConcurrent(const std::string_view& word, DocumentPredicate document_predicate, ConcurrentMap<int, double>& document_to_relevance) const {
-    if (word_to_document_freqs_.count(word) != 0) {
-        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-        for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-            const auto& document_data = documents_.at(document_id);
-            if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                document_to_relevance[document_id].ref_to_value += term_freq * inverse_document_freq;
+std::pmr::vector<Document> SearchServer::FindAllDocumentsConjunctive(const Query& query, DocumentPredicate document_predicate, QueryContext& context) const {
+    QueryProfile* const profile = context.profile;
+    std::pmr::vector<Document> matched_documents(context.resource);
+    std::pmr::vector<int> term_ids(context.resource);
+    std::pmr::vector<double> inverse_document_freqs(context.resource);
+    bool has_missing_word = false;
+    for (const std::string_view word : query.plus_words) {
+        const int term_id = term_dictionary_.Find(word);
+        const int document_freq = GetDocumentFreq(term_id);
+        TermProfile* term_profile = profile ? &profile->AddTerm(word, false) : nullptr;
+        if (document_freq == 0) {
+            has_missing_word = true;
+            continue;
+        }
+        term_ids.push_back(term_id);
+        inverse_document_freqs.push_back(ComputeWordInverseDocumentFreq(word, document_freq, context));
+        if (term_profile) {
+            term_profile->inverse_document_freq = inverse_document_freqs.back();
+        }
+    }
+    // groups[g] holds the indexes into term_ids of the terms of query.plus_groups[g];
+    // with no word missing, term_ids follows the sorted plus_words.
+    std::pmr::vector<std::pmr::vector<size_t>> groups(context.resource);
+    for (size_t g = 0; g < query.plus_groups.size() && !has_missing_word; ++g) {
+        auto& members = groups.emplace_back();
+        for (const std::string_view word : query.plus_groups[g]) {
+            members.push_back(std::lower_bound(query.plus_words.begin(), query.plus_words.end(), word) - query.plus_words.begin());
+        }
+        has_missing_word = members.empty();
+    }
+    if (has_missing_word) {
+        term_ids.clear();
+    }
+    std::pmr::vector<int> minus_term_ids(context.resource);
+    for (const std::string_view word : query.minus_words) {
+        const int term_id = term_dictionary_.Find(word);
+        if (profile) {
+            profile->AddTerm(word, true).posting_length = GetDocumentFreq(term_id);
+        }
+        if (GetDocumentFreq(term_id) > 0) {
+            minus_term_ids.push_back(term_id);
+        }
+    }
+
+    StageTimer scan_timer(metrics_, SearchStage::POSTING_SCAN, profile ? &profile->scan_time : nullptr);
+    std::pmr::vector<PostingList> lists(term_ids.size(), context.resource);
+    std::pmr::vector<const int*> cursors(term_ids.size(), context.resource);
+    std::pmr::vector<PostingList> minus_lists(minus_term_ids.size(), context.resource);
+    std::pmr::vector<const int*> minus_cursors(minus_term_ids.size(), context.resource);
+    std::pmr::vector<int> lead_ordinals(context.resource);
+    size_t postings_scanned = 0;
+    const auto intersect = [&](const auto& segment) {
+        for (size_t i = 0; i < term_ids.size(); ++i) {
+            lists[i] = segment.FindPostings(term_ids[i]);
+            cursors[i] = lists[i].ordinals;
+            if (profile) {
+                profile->terms[i].posting_length += lists[i].size;
             }
         }
+        size_t lead = 0;
+        size_t lead_size = std::numeric_limits<size_t>::max();
+        for (size_t g = 0; g < groups.size(); ++g) {
+            size_t group_size = 0;
+            for (const size_t i : groups[g]) {
+                group_size += lists[i].size;
+            }
+            if (group_size == 0) {
+                return;
+            }
+            if (group_size < lead_size) {
+                lead = g;
+                lead_size = group_size;
+            }
+        }
+        for (size_t i = 0; i < minus_term_ids.size(); ++i) {
+            minus_lists[i] = segment.FindPostings(minus_term_ids[i]);
+            minus_cursors[i] = minus_lists[i].ordinals;
+        }
+        // A document in several lists of the lead group is visited once.
+        const PostingList* lead_list = &lists[groups[lead].front()];
+        const int* lead_begin = lead_list->ordinals;
+        const int* lead_end = lead_list->ordinals + lead_list->size;
+        if (groups[lead].size() > 1) {
+            lead_ordinals.clear();
+            for (const size_t i : groups[lead]) {
+                lead_ordinals.insert(lead_ordinals.end(), lists[i].ordinals, lists[i].ordinals + lists[i].size);
+            }
+            std::sort(lead_ordinals.begin(), lead_ordinals.end());
+            lead_ordinals.erase(std::unique(lead_ordinals.begin(), lead_ordinals.end()), lead_ordinals.end());
+            lead_begin = lead_ordinals.data();
+            lead_end = lead_ordinals.data() + lead_ordinals.size();
+        }
+        TermProfile* const lead_profile = profile ? &profile->terms[groups[lead].front()] : nullptr;
+
+        for (const int* lead_cursor = lead_begin; lead_cursor != lead_end; ++lead_cursor) {
+            if (((lead_cursor - lead_begin) & (POSTING_BLOCK_SIZE - 1)) == 0 && context.IsOutOfBudget()) {
+                return;
+            }
+            const int ordinal = *lead_cursor;
+            ++postings_scanned;
+            bool in_all = true;
+            for (size_t g = 0; g < groups.size() && in_all; ++g) {
+                if (g == lead) {
+                    continue;
+                }
+                bool in_group = false;
+                bool exhausted = true;
+                for (size_t k = 0; k < groups[g].size() && !in_group; ++k) {
+                    const PostingList& list = lists[groups[g][k]];
+                    const int*& cursor = cursors[groups[g][k]];
+                    cursor = GallopTo(cursor, list.ordinals + list.size, ordinal);
+                    ++postings_scanned;
+                    if (cursor != list.ordinals + list.size) {
+                        exhausted = false;
+                        in_group = *cursor == ordinal;
+                    }
+                }
+                if (exhausted) {
+                    return;
+                }
+                in_all = in_group;
+            }
+            if (!in_all) {
+                continue;
+            }
+            if (!document_alive_[ordinal]) {
+                if (lead_profile) {
+                    ++lead_profile->documents_dead;
+                }
+                continue;
+            }
+            const bool passed = document_predicate(document_external_ids_[ordinal], document_statuses_[ordinal], document_ratings_[ordinal]);
+            if (lead_profile) {
+                ++(passed ? lead_profile->predicate_passed : lead_profile->predicate_rejected);
+            }
+            if (!passed) {
+                continue;
+            }
+            bool has_minus_word = false;
+            for (size_t i = 0; i < minus_lists.size() && !has_minus_word; ++i) {
+                minus_cursors[i] = GallopTo(minus_cursors[i], minus_lists[i].ordinals + minus_lists[i].size, ordinal);
+                has_minus_word = minus_cursors[i] != minus_lists[i].ordinals + minus_lists[i].size && *minus_cursors[i] == ordinal;
+            }
+            if (has_minus_word) {
+                continue;
+            }
+            // Summed in query order over the terms the document holds, as FindAllDocuments
+            // does, so relevance is bit-identical.
+            double relevance = 0.0;
+            for (size_t i = 0; i < lists.size(); ++i) {
+                cursors[i] = GallopTo(cursors[i], lists[i].ordinals + lists[i].size, ordinal);
+                if (cursors[i] != lists[i].ordinals + lists[i].size && *cursors[i] == ordinal) {
+                    relevance += lists[i].term_freqs[cursors[i] - lists[i].ordinals] * inverse_document_freqs[i];
+                }
+            }
+            matched_documents.push_back({ document_external_ids_[ordinal], relevance, document_ratings_[ordinal] });
+        }
+    };
+    if (!term_ids.empty()) {
+        for (const auto& segment : segments_) {
+            intersect(*segment);
+        }
+        intersect(mutable_segment_);
+    }
+    metrics_.RecordQuery(postings_scanned, matched_documents.size());
+    if (profile) {
+        profile->FinishScan(matched_documents.size());
+    }
+    return matched_documents;
+}
+
+template <typename DocumentPredicate>
+size_t SearchServer::ScanOrdinalRange(const std::pmr::vector<ScanTask>& tasks, int begin, int end, DocumentPredicate document_predicate,
+    std::pmr::vector<std::pair<int, double>>& documents, TermProfile* term_stats, QueryContext& context) const {
+    const auto lease = score_accumulators_.Acquire();
+    ScoreAccumulator& accumulator = *lease;
+    accumulator.Start(begin, end, scoring_precision_);
+    size_t scanned = 0;
+    for (const ScanTask& task : tasks) {
+        TermProfile* term_profile = term_stats ? &term_stats[task.term_index] : nullptr;
+        TermTimer term_timer(term_profile);
+        const int* const first = std::lower_bound(task.postings.ordinals, task.postings.ordinals + task.postings.size, begin);
+        const int* const last = std::lower_bound(first, task.postings.ordinals + task.postings.size, end);
+        scanned += ScorePostings(first, task.postings.term_freqs + (first - task.postings.ordinals), last - first,
+            task.inverse_document_freq, document_predicate, accumulator, term_profile, context);
     }
-}
\ No newline at end of file
+    documents.reserve(accumulator.GetAcceptedCount());
+    accumulator.ForEachAccepted([&documents](int ordinal, double relevance) {
+        documents.emplace_back(ordinal, relevance);
+        });
+    return scanned;
+}
+
+// The first posting that reaches a document decides whether it is accepted, and
+// that document is counted once in term_stats; each block is then scored at once by
+// the vector kernel. Returns the postings read.
+template <typename DocumentPredicate>
+size_t SearchServer::ScorePostings(const int* ordinals, const double* term_freqs, size_t count, double inverse_document_freq,
+    DocumentPredicate document_predicate, ScoreAccumulator& accumulator, TermProfile* term_stats, QueryContext& context) const {
+    uint8_t mask[POSTING_BLOCK_SIZE];
+    size_t scanned = 0;
+    while (scanned < count && !context.IsOutOfBudget()) {
+        const size_t block_size = std::min(POSTING_BLOCK_SIZE, count - scanned);
+        const int* const block = ordinals + scanned;
+        for (size_t i = 0; i < block_size; ++i) {
+            const int ordinal = block[i];
+            if (accumulator.Visit(ordinal)) {
+                if (!document_alive_[ordinal]) {
+                    if (term_stats) {
+                        ++term_stats->documents_dead;
+                    }
+                }
+                else if (document_predicate(document_external_ids_[ordinal], document_statuses_[ordinal], document_ratings_[ordinal])) {
+                    accumulator.Accept(ordinal);
+                    if (term_stats) {
+                        ++term_stats->predicate_passed;
+                    }
+                }
+                else if (term_stats) {
+                    ++term_stats->predicate_rejected;
+                }
+            }
+            mask[i] = accumulator.IsAccepted(ordinal);
+        }
+        accumulator.ScoreBlock(block, term_freqs + scanned, mask, block_size, inverse_document_freq);
+        scanned += block_size;
+    }
+    return scanned;
+}
+
+template <typename Func>
+void SearchServer::ForEachPostingList(int term_id, Func func) const {
+    for (const auto& segment : segments_) {
+        func(segment->FindPostings(term_id));
+    }
+    func(mutable_segment_.FindPostings(term_id));
+}
@@ -0,0 +1,199 @@
+#include "shard_coordinator.h"
+
+#include <algorithm>
+#include <optional>
+#include <stdexcept>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "search_server.h"
+#include "shard_server.h"
+
+using namespace std;
+
+namespace {
+
+// Returns the reply payload, or the exception the shard's SearchServer threw.
+string TakeReply(Frame& reply) {
+    if (reply.type == MessageType::OK) {
+        return move(reply.payload);
+    }
+    if (reply.type != MessageType::ERROR) {
+        throw runtime_error("Unexpected shard reply"s);
+    }
+    MessageReader reader(reply.payload);
+    const auto kind = static_cast<ErrorKind>(reader.GetU8());
+    const string message(reader.GetString());
+    switch (kind) {
+    case ErrorKind::INVALID_ARGUMENT:
+        throw invalid_argument(message);
+    case ErrorKind::OUT_OF_RANGE:
+        throw out_of_range(message);
+    default:
+        throw runtime_error(message);
+    }
+}
+
+Frame ReceiveReply(int socket) {
+    Frame reply;
+    if (!ReceiveFrame(socket, reply)) {
+        throw runtime_error("Shard closed the connection"s);
+    }
+    return reply;
+}
+
+} // namespace
+
+ShardCoordinator::ShardCoordinator(const vector<uint16_t>& ports) {
+    if (ports.empty()) {
+        throw invalid_argument("At least one shard is required"s);
+    }
+    try {
+        for (const uint16_t port : ports) {
+            sockets_.push_back(ConnectToLoopback(port));
+        }
+    }
+    catch (...) {
+        Close();
+        throw;
+    }
+}
+
+ShardCoordinator::ShardCoordinator(size_t shard_count, const string& stop_words_text) {
+    if (shard_count == 0) {
+        throw invalid_argument("At least one shard is required"s);
+    }
+    for (size_t shard = 0; shard < shard_count; ++shard) {
+        int ends[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, ends) != 0) {
+            Close();
+            throw runtime_error("Cannot create shard socket pair"s);
+        }
+        const pid_t process = fork();
+        if (process < 0) {
+            close(ends[0]);
+            close(ends[1]);
+            Close();
+            throw runtime_error("Cannot start shard process"s);
+        }
+        if (process == 0) {
+            close(ends[0]);
+            for (const int socket : sockets_) {
+                close(socket);
+            }
+            int exit_code = 0;
+            try {
+                SearchServer search_server(stop_words_text);
+                ShardServer(search_server).Serve(ends[1]);
+            }
+            catch (...) {
+                exit_code = 1;
+            }
+            _exit(exit_code);
+        }
+        close(ends[1]);
+        sockets_.push_back(ends[0]);
+        processes_.push_back(process);
+    }
+}
+
+ShardCoordinator::~ShardCoordinator() {
+    Close();
+}
+
+// Closing a socket ends its shard's Serve loop, so the processes can be reaped.
+void ShardCoordinator::Close() {
+    for (const int socket : sockets_) {
+        close(socket);
+    }
+    for (const pid_t process : processes_) {
+        waitpid(process, nullptr, 0);
+    }
+    sockets_.clear();
+    processes_.clear();
+}
+
+void ShardCoordinator::AddDocument(int document_id, string_view document, DocumentStatus status, const vector<int>& ratings) {
+    MessageWriter writer;
+    writer.PutI32(document_id);
+    writer.PutU8(static_cast<uint8_t>(status));
+    writer.PutU32(static_cast<uint32_t>(ratings.size()));
+    for (const int rating : ratings) {
+        writer.PutI32(rating);
+    }
+    writer.PutString(document);
+    Call(GetShard(document_id), MessageType::ADD_DOCUMENT, writer.GetBuffer());
+}
+
+void ShardCoordinator::RemoveDocument(int document_id) {
+    MessageWriter writer;
+    writer.PutI32(document_id);
+    Call(GetShard(document_id), MessageType::REMOVE_DOCUMENT, writer.GetBuffer());
+}
+
+vector<Document> ShardCoordinator::FindTopDocuments(string_view raw_query, DocumentStatus status) {
+    MessageWriter stats_request;
+    stats_request.PutString(raw_query);
+    CollectionStats collection_stats;
+    for (const string& reply : CallAll(MessageType::GET_COLLECTION_STATS, stats_request.GetBuffer())) {
+        const CollectionStats shard_stats = MessageReader(reply).GetCollectionStats();
+        collection_stats.document_count += shard_stats.document_count;
+        for (const auto& [word, document_freq] : shard_stats.document_freqs) {
+            collection_stats.document_freqs[word] += document_freq;
+        }
+    }
+
+    MessageWriter search_request;
+    search_request.PutString(raw_query);
+    search_request.PutU8(static_cast<uint8_t>(status));
+    search_request.PutCollectionStats(collection_stats);
+    vector<Document> documents;
+    for (const string& reply : CallAll(MessageType::FIND_TOP_DOCUMENTS, search_request.GetBuffer())) {
+        const vector<Document> shard_documents = MessageReader(reply).GetDocuments();
+        documents.insert(documents.end(), shard_documents.begin(), shard_documents.end());
+    }
+    sort(documents.begin(), documents.end(), IsRankedHigher);
+    if (documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
+        documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+    }
+    return documents;
+}
+
+int ShardCoordinator::GetDocumentCount() {
+    int document_count = 0;
+    for (const string& reply : CallAll(MessageType::GET_DOCUMENT_COUNT, {})) {
+        document_count += MessageReader(reply).GetI32();
+    }
+    return document_count;
+}
+
+size_t ShardCoordinator::GetShard(int document_id) const {
+    return static_cast<uint32_t>(document_id) % sockets_.size();
+}
+
+string ShardCoordinator::Call(size_t shard, MessageType type, string_view payload) {
+    SendFrame(sockets_[shard], type, payload);
+    Frame reply = ReceiveReply(sockets_[shard]);
+    return TakeReply(reply);
+}
+
+// Every reply is read before any error is rethrown, so no connection is left with
+// an unread reply.
+vector<string> ShardCoordinator::CallAll(MessageType type, string_view payload) {
+    for (const int socket : sockets_) {
+        SendFrame(socket, type, payload);
+    }
+    vector<Frame> replies;
+    replies.reserve(sockets_.size());
+    for (const int socket : sockets_) {
+        replies.push_back(ReceiveReply(socket));
+    }
+    vector<string> payloads;
+    payloads.reserve(replies.size());
+    for (Frame& reply : replies) {
+        payloads.push_back(TakeReply(reply));
+    }
+    return payloads;
+}
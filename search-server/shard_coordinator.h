@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "document.h"
+#include "shard_protocol.h"
+
+// Spreads a collection over several shard servers. Documents are routed by id, so
+// each id lives on exactly one shard and duplicate ids are still rejected. A query
+// is scattered to every shard and the per-shard top documents are merged with
+// the usual relevance/rating order. Requests are sent to all shards before any
+// reply is read, so the shards work in parallel.
+class ShardCoordinator {
+public:
+    // Connects to shard servers listening on loopback TCP ports.
+    explicit ShardCoordinator(const std::vector<uint16_t>& ports);
+    // Forks `shard_count` local shard processes, each with its own SearchServer,
+    // connected over Unix socket pairs. Fork before starting other threads. The
+    // processes exit when the coordinator is destroyed.
+    ShardCoordinator(size_t shard_count, const std::string& stop_words_text);
+
+    ShardCoordinator(const ShardCoordinator&) = delete;
+    ShardCoordinator& operator=(const ShardCoordinator&) = delete;
+    ~ShardCoordinator();
+
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    void RemoveDocument(int document_id);
+
+    // Two phases: the document frequencies of the plus words are gathered from every
+    // shard and summed, then every shard ranks its documents with that collection-wide
+    // IDF. Relevance therefore equals that of a single server holding all documents.
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status = DocumentStatus::ACTUAL);
+
+    int GetDocumentCount();
+
+    size_t GetShardCount() const {
+        return sockets_.size();
+    }
+
+private:
+    void Close();
+    size_t GetShard(int document_id) const;
+    std::string Call(size_t shard, MessageType type, std::string_view payload);
+    std::vector<std::string> CallAll(MessageType type, std::string_view payload);
+
+    std::vector<int> sockets_;
+    std::vector<pid_t> processes_;
+};
@@ -0,0 +1,243 @@
+#include "shard_protocol.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+constexpr uint32_t MAX_FRAME_SIZE = 1u << 30;
+constexpr size_t FRAME_HEADER_SIZE = 5;
+
+void SendAll(int socket, const char* data, size_t size) {
+    while (size > 0) {
+        const ssize_t sent = send(socket, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            throw runtime_error("Shard connection lost: "s + strerror(errno));
+        }
+        data += sent;
+        size -= sent;
+    }
+}
+
+// Returns the number of bytes read, which is less than `size` only at end of stream.
+size_t ReceiveAll(int socket, char* data, size_t size) {
+    size_t received = 0;
+    while (received < size) {
+        const ssize_t count = recv(socket, data + received, size - received, 0);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            throw runtime_error("Shard connection lost: "s + strerror(errno));
+        }
+        if (count == 0) {
+            break;
+        }
+        received += count;
+    }
+    return received;
+}
+
+sockaddr_in LoopbackAddress(uint16_t port) {
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return address;
+}
+
+// Requests and replies are small and strictly alternate, so Nagle's algorithm
+// would only add latency.
+void DisableNagle(int socket) {
+    const int enabled = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+}
+
+} // namespace
+
+void MessageWriter::PutU8(uint8_t value) {
+    buffer_.push_back(static_cast<char>(value));
+}
+
+void MessageWriter::PutU32(uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) {
+        buffer_.push_back(static_cast<char>((value >> shift) & 0xFF));
+    }
+}
+
+void MessageWriter::PutI32(int32_t value) {
+    PutU32(static_cast<uint32_t>(value));
+}
+
+void MessageWriter::PutDouble(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    PutU32(static_cast<uint32_t>(bits));
+    PutU32(static_cast<uint32_t>(bits >> 32));
+}
+
+void MessageWriter::PutString(string_view value) {
+    PutU32(static_cast<uint32_t>(value.size()));
+    buffer_.append(value);
+}
+
+void MessageWriter::PutDocuments(const vector<Document>& documents) {
+    PutU32(static_cast<uint32_t>(documents.size()));
+    for (const Document& document : documents) {
+        PutI32(document.id);
+        PutDouble(document.relevance);
+        PutI32(document.rating);
+    }
+}
+
+void MessageWriter::PutCollectionStats(const CollectionStats& stats) {
+    PutI32(stats.document_count);
+    PutU32(static_cast<uint32_t>(stats.document_freqs.size()));
+    for (const auto& [word, document_freq] : stats.document_freqs) {
+        PutString(word);
+        PutI32(document_freq);
+    }
+}
+
+string_view MessageReader::Take(size_t size) {
+    if (buffer_.size() < size) {
+        throw runtime_error("Truncated shard message"s);
+    }
+    const string_view field = buffer_.substr(0, size);
+    buffer_.remove_prefix(size);
+    return field;
+}
+
+uint8_t MessageReader::GetU8() {
+    return static_cast<uint8_t>(Take(1)[0]);
+}
+
+uint32_t MessageReader::GetU32() {
+    const string_view bytes = Take(4);
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; --i) {
+        value = (value << 8) | static_cast<uint8_t>(bytes[i]);
+    }
+    return value;
+}
+
+int32_t MessageReader::GetI32() {
+    return static_cast<int32_t>(GetU32());
+}
+
+double MessageReader::GetDouble() {
+    const uint64_t low = GetU32();
+    const uint64_t bits = low | (uint64_t{ GetU32() } << 32);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+string_view MessageReader::GetString() {
+    return Take(GetU32());
+}
+
+vector<Document> MessageReader::GetDocuments() {
+    vector<Document> documents(GetU32());
+    for (Document& document : documents) {
+        document.id = GetI32();
+        document.relevance = GetDouble();
+        document.rating = GetI32();
+    }
+    return documents;
+}
+
+CollectionStats MessageReader::GetCollectionStats() {
+    CollectionStats stats;
+    stats.document_count = GetI32();
+    for (uint32_t count = GetU32(); count > 0; --count) {
+        const string_view word = GetString();
+        stats.document_freqs.emplace(word, GetI32());
+    }
+    return stats;
+}
+
+void SendFrame(int socket, MessageType type, string_view payload) {
+    MessageWriter header;
+    header.PutU32(static_cast<uint32_t>(payload.size()));
+    header.PutU8(static_cast<uint8_t>(type));
+    SendAll(socket, header.GetBuffer().data(), header.GetBuffer().size());
+    SendAll(socket, payload.data(), payload.size());
+}
+
+bool ReceiveFrame(int socket, Frame& frame) {
+    char header[FRAME_HEADER_SIZE];
+    const size_t received = ReceiveAll(socket, header, FRAME_HEADER_SIZE);
+    if (received == 0) {
+        return false;
+    }
+    if (received < FRAME_HEADER_SIZE) {
+        throw runtime_error("Shard connection closed mid-frame"s);
+    }
+    MessageReader reader(string_view(header, FRAME_HEADER_SIZE));
+    const uint32_t size = reader.GetU32();
+    if (size > MAX_FRAME_SIZE) {
+        throw runtime_error("Shard frame too large"s);
+    }
+    frame.type = static_cast<MessageType>(reader.GetU8());
+    frame.payload.resize(size);
+    if (ReceiveAll(socket, frame.payload.data(), size) < size) {
+        throw runtime_error("Shard connection closed mid-frame"s);
+    }
+    return true;
+}
+
+int ListenOnLoopback(uint16_t port) {
+    const int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) {
+        throw runtime_error("Cannot create socket: "s + strerror(errno));
+    }
+    const int enabled = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enabled, sizeof(enabled));
+    const sockaddr_in address = LoopbackAddress(port);
+    if (bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        const int error = errno;
+        close(listener);
+        throw runtime_error("Cannot listen on port "s + to_string(port) + ": "s + strerror(error));
+    }
+    return listener;
+}
+
+int AcceptConnection(int listener) {
+    int connection;
+    do {
+        connection = accept(listener, nullptr, nullptr);
+    } while (connection < 0 && errno == EINTR);
+    if (connection < 0) {
+        throw runtime_error("Cannot accept connection: "s + strerror(errno));
+    }
+    DisableNagle(connection);
+    return connection;
+}
+
+int ConnectToLoopback(uint16_t port) {
+    const int connection = socket(AF_INET, SOCK_STREAM, 0);
+    if (connection < 0) {
+        throw runtime_error("Cannot create socket: "s + strerror(errno));
+    }
+    const sockaddr_in address = LoopbackAddress(port);
+    if (connect(connection, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        const int error = errno;
+        close(connection);
+        throw runtime_error("Cannot connect to port "s + to_string(port) + ": "s + strerror(error));
+    }
+    DisableNagle(connection);
+    return connection;
+}
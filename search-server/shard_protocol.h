@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "document.h"
+
+// Wire format between a ShardCoordinator and its shard servers. Every message is a
+// frame: a 4-byte payload length, a 1-byte message type and the payload. Integers
+// are little-endian, doubles are sent as their IEEE-754 bits, strings are a
+// 4-byte length followed by the bytes.
+enum class MessageType : uint8_t {
+    ADD_DOCUMENT = 1,
+    REMOVE_DOCUMENT,
+    GET_DOCUMENT_COUNT,
+    GET_COLLECTION_STATS,
+    FIND_TOP_DOCUMENTS,
+    OK = 100,
+    ERROR,
+};
+
+// Exception kinds are carried over the wire, so the coordinator throws what the
+// shard's SearchServer threw.
+enum class ErrorKind : uint8_t {
+    INVALID_ARGUMENT,
+    OUT_OF_RANGE,
+    RUNTIME,
+};
+
+struct Frame {
+    MessageType type = MessageType::OK;
+    std::string payload;
+};
+
+class MessageWriter {
+public:
+    void PutU8(uint8_t value);
+    void PutI32(int32_t value);
+    void PutU32(uint32_t value);
+    void PutDouble(double value);
+    void PutString(std::string_view value);
+    void PutDocuments(const std::vector<Document>& documents);
+    void PutCollectionStats(const CollectionStats& stats);
+
+    std::string& GetBuffer() {
+        return buffer_;
+    }
+
+private:
+    std::string buffer_;
+};
+
+// Reads fields in the order they were written; throws runtime_error on a
+// truncated message.
+class MessageReader {
+public:
+    explicit MessageReader(std::string_view buffer)
+        : buffer_(buffer) {
+    }
+
+    uint8_t GetU8();
+    int32_t GetI32();
+    uint32_t GetU32();
+    double GetDouble();
+    std::string_view GetString();
+    std::vector<Document> GetDocuments();
+    CollectionStats GetCollectionStats();
+
+private:
+    std::string_view Take(size_t size);
+
+    std::string_view buffer_;
+};
+
+// Blocking I/O on a connected stream socket; both throw runtime_error when the
+// peer goes away. ReceiveFrame returns false instead if the peer closed the
+// connection cleanly between frames.
+void SendFrame(int socket, MessageType type, std::string_view payload);
+bool ReceiveFrame(int socket, Frame& frame);
+
+// Loopback TCP helpers; all return a socket the caller owns.
+int ListenOnLoopback(uint16_t port);
+int AcceptConnection(int listener);
+int ConnectToLoopback(uint16_t port);
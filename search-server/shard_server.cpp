@@ -0,0 +1,87 @@
+#include "shard_server.h"
+
+#include <stdexcept>
+
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+Frame MakeError(ErrorKind kind, const exception& e) {
+    MessageWriter writer;
+    writer.PutU8(static_cast<uint8_t>(kind));
+    writer.PutString(e.what());
+    return { MessageType::ERROR, move(writer.GetBuffer()) };
+}
+
+} // namespace
+
+void ShardServer::Serve(int socket) {
+    Frame request;
+    while (ReceiveFrame(socket, request)) {
+        const Frame reply = Handle(request);
+        SendFrame(socket, reply.type, reply.payload);
+    }
+}
+
+void ShardServer::Listen(uint16_t port) {
+    const int listener = ListenOnLoopback(port);
+    while (true) {
+        const int connection = AcceptConnection(listener);
+        try {
+            Serve(connection);
+        }
+        catch (const runtime_error&) {
+            // The coordinator went away mid-request; wait for the next one.
+        }
+        close(connection);
+    }
+}
+
+Frame ShardServer::Handle(const Frame& request) {
+    MessageReader reader(request.payload);
+    MessageWriter writer;
+    try {
+        switch (request.type) {
+        case MessageType::ADD_DOCUMENT: {
+            const int document_id = reader.GetI32();
+            const auto status = static_cast<DocumentStatus>(reader.GetU8());
+            vector<int> ratings(reader.GetU32());
+            for (int& rating : ratings) {
+                rating = reader.GetI32();
+            }
+            search_server_.AddDocument(document_id, reader.GetString(), status, ratings);
+            break;
+        }
+        case MessageType::REMOVE_DOCUMENT:
+            search_server_.RemoveDocument(reader.GetI32());
+            break;
+        case MessageType::GET_DOCUMENT_COUNT:
+            writer.PutI32(search_server_.GetDocumentCount());
+            break;
+        case MessageType::GET_COLLECTION_STATS:
+            writer.PutCollectionStats(search_server_.GetCollectionStats(reader.GetString()));
+            break;
+        case MessageType::FIND_TOP_DOCUMENTS: {
+            const string_view raw_query = reader.GetString();
+            const auto status = static_cast<DocumentStatus>(reader.GetU8());
+            const CollectionStats stats = reader.GetCollectionStats();
+            writer.PutDocuments(search_server_.FindTopDocuments(raw_query, status, stats));
+            break;
+        }
+        default:
+            throw runtime_error("Unknown shard request "s + to_string(static_cast<int>(request.type)));
+        }
+    }
+    catch (const invalid_argument& e) {
+        return MakeError(ErrorKind::INVALID_ARGUMENT, e);
+    }
+    catch (const out_of_range& e) {
+        return MakeError(ErrorKind::OUT_OF_RANGE, e);
+    }
+    catch (const exception& e) {
+        return MakeError(ErrorKind::RUNTIME, e);
+    }
+    return { MessageType::OK, move(writer.GetBuffer()) };
+}
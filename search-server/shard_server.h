@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+
+#include "search_server.h"
+#include "shard_protocol.h"
+
+// Serves one SearchServer to a ShardCoordinator. Requests on a connection are
+// handled one at a time, in the order they arrive.
+class ShardServer {
+public:
+    explicit ShardServer(SearchServer& search_server)
+        : search_server_(search_server) {
+    }
+
+    // Handles requests until the peer closes the connection.
+    void Serve(int socket);
+    // Accepts coordinators on a loopback port, one connection after another; never returns.
+    [[noreturn]] void Listen(uint16_t port);
+
+private:
+    Frame Handle(const Frame& request);
+
+    SearchServer& search_server_;
+};
@@ -2,8 +2,10 @@
 
 using namespace std;
 
-vector<string_view> SplitIntoWords(string_view str) {
-    vector<string_view> result;
+namespace {
+
+template <typename Container>
+void AppendWords(string_view str, Container& result) {
     const int64_t pos_end = str.npos;
     while (true) {
         int64_t space = str.find(' ');
@@ -15,6 +17,18 @@ vector<string_view> SplitIntoWords(string_view str) {
             str.remove_prefix(space + 1);
         }
     }
+}
+
+} // namespace
+
+vector<string_view> SplitIntoWords(string_view str) {
+    vector<string_view> result;
+    AppendWords(str, result);
+    return result;
+}
 
+pmr::vector<string_view> SplitIntoWords(string_view str, pmr::memory_resource* resource) {
+    pmr::vector<string_view> result(resource);
+    AppendWords(str, result);
     return result;
-}
\ No newline at end of file
+}
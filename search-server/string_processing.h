@@ -1,11 +1,13 @@
 #pragma once
 
+#include <memory_resource>
 #include <string>
 #include <string_view>
 #include <vector>
 #include <set>
 
 std::vector<std::string_view> SplitIntoWords(std::string_view str);
+std::pmr::vector<std::string_view> SplitIntoWords(std::string_view str, std::pmr::memory_resource* resource);
 
 template <typename StringContainer>
 std::set<std::string, std::less<>> MakeUniqueNonEmptyStrings(const StringContainer& strings) {
@@ -0,0 +1,157 @@
+#include "term_dictionary.h"
+
+#include <algorithm>
+#include <numeric>
+
+using namespace std;
+
+int TermDictionary::Find(string_view word, uint64_t hash) const {
+    return slots_[FindSlot(word, hash)].term_id;
+}
+
+int TermDictionary::FindOrAdd(string_view word) {
+    const uint64_t hash = Hash(word);
+    size_t index = FindSlot(word, hash);
+    if (slots_[index].term_id != NOT_FOUND) {
+        return slots_[index].term_id;
+    }
+    // Keep the load factor at or below one half so probe sequences stay short.
+    if ((terms_.size() + 1) * 2 > slots_.size()) {
+        Grow();
+        index = FindSlot(word, hash);
+    }
+    const int term_id = static_cast<int>(terms_.size());
+    terms_.emplace_back(word);
+    slots_[index] = { hash, term_id };
+    return term_id;
+}
+
+size_t TermDictionary::FindSlot(string_view word, uint64_t hash) const {
+    const size_t mask = slots_.size() - 1;
+    for (size_t index = hash & mask;; index = (index + 1) & mask) {
+        const Slot& slot = slots_[index];
+        if (slot.term_id == NOT_FOUND || (slot.hash == hash && terms_[slot.term_id] == word)) {
+            return index;
+        }
+    }
+}
+
+void TermDictionary::Grow() {
+    pmr::vector<Slot> slots(slots_.size() * 2, slots_.get_allocator());
+    const size_t mask = slots.size() - 1;
+    for (const Slot& slot : slots_) {
+        if (slot.term_id == NOT_FOUND) {
+            continue;
+        }
+        size_t index = slot.hash & mask;
+        while (slots[index].term_id != NOT_FOUND) {
+            index = (index + 1) & mask;
+        }
+        slots[index] = slot;
+    }
+    slots_.swap(slots);
+}
+
+void TermTrie::Build(const vector<string_view>& terms) {
+    nodes_.clear();
+    labels_.clear();
+    term_ids_.resize(terms.size());
+    iota(term_ids_.begin(), term_ids_.end(), 0);
+    sort(term_ids_.begin(), term_ids_.end(), [&terms](int lhs, int rhs) {
+        return terms[lhs] < terms[rhs];
+        });
+    const auto term = [this, &terms](uint32_t index) {
+        return terms[term_ids_[index]];
+    };
+
+    // Nodes are laid out breadth first, which keeps the children of a node together.
+    // depths[i] is the length of the prefix node i stands for.
+    nodes_.push_back({ 0, 0, 0, 0, 0, static_cast<uint32_t>(term_ids_.size()) });
+    vector<size_t> depths{ 0 };
+    for (size_t index = 0; index < nodes_.size(); ++index) {
+        const size_t depth = depths[index];
+        uint32_t begin = nodes_[index].term_begin;
+        const uint32_t end = nodes_[index].term_end;
+        if (begin < end && term(begin).size() == depth) {
+            ++begin;
+        }
+        nodes_[index].first_child = static_cast<uint32_t>(nodes_.size());
+        while (begin < end) {
+            const char c = term(begin)[depth];
+            uint32_t run_end = begin + 1;
+            while (run_end < end && term(run_end)[depth] == c) {
+                ++run_end;
+            }
+            // The label runs to the longest common prefix of the child's terms, which
+            // for a sorted run is that of its first and last term.
+            const string_view first = term(begin);
+            const string_view last = term(run_end - 1);
+            size_t label_end = depth + 1;
+            while (label_end < first.size() && label_end < last.size() && first[label_end] == last[label_end]) {
+                ++label_end;
+            }
+            nodes_.push_back({ static_cast<uint32_t>(labels_.size()), static_cast<uint32_t>(label_end - depth), 0, 0, begin, run_end });
+            labels_.append(first.substr(depth, label_end - depth));
+            depths.push_back(label_end);
+            begin = run_end;
+        }
+        nodes_[index].child_count = static_cast<uint32_t>(nodes_.size()) - nodes_[index].first_child;
+    }
+    nodes_.shrink_to_fit();
+    labels_.shrink_to_fit();
+    term_ids_.shrink_to_fit();
+}
+
+const TermTrie::Node* TermTrie::Descend(string_view prefix) const {
+    if (nodes_.empty()) {
+        return nullptr;
+    }
+    const Node* node = &nodes_.front();
+    size_t depth = 0;
+    while (depth < prefix.size()) {
+        const Node* const first = nodes_.data() + node->first_child;
+        const Node* const last = first + node->child_count;
+        const unsigned char c = prefix[depth];
+        const Node* const child = lower_bound(first, last, c, [this](const Node& child, unsigned char c) {
+            return static_cast<unsigned char>(labels_[child.label_begin]) < c;
+            });
+        if (child == last || static_cast<unsigned char>(labels_[child->label_begin]) != c) {
+            return nullptr;
+        }
+        const string_view label(labels_.data() + child->label_begin, child->label_size);
+        const size_t length = min(label.size(), prefix.size() - depth);
+        if (label.substr(0, length) != prefix.substr(depth, length)) {
+            return nullptr;
+        }
+        depth += length;
+        node = child;
+    }
+    return node;
+}
+
+bool StopWordSet::Contains(string_view word) const {
+    const uint64_t hash = TermDictionary::Hash(word);
+    return MayContain(hash) && words_.Find(word, hash) != TermDictionary::NOT_FOUND;
+}
+
+// The two probe positions come from the upper bits, which the dictionary's own
+// slot index (the low bits) does not use.
+array<size_t, 2> StopWordSet::FilterBits(uint64_t hash) const {
+    const size_t mask = filter_.size() * 64 - 1;
+    return { (hash >> 32) & mask, ((hash >> 48) ^ (hash >> 16)) & mask };
+}
+
+void StopWordSet::AddToFilter(uint64_t hash) {
+    for (const size_t bit : FilterBits(hash)) {
+        filter_[bit / 64] |= uint64_t{ 1 } << (bit % 64);
+    }
+}
+
+bool StopWordSet::MayContain(uint64_t hash) const {
+    for (const size_t bit : FilterBits(hash)) {
+        if ((filter_[bit / 64] & (uint64_t{ 1 } << (bit % 64))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Assigns dense ids to terms. Lookups hash the word once and probe an
+// open-addressing table whose slots keep the full hash, so a miss or a collision
+// is almost always rejected without touching the term text. Term text is stored
+// here and never moves, so views returned by GetTerm stay valid.
+class TermDictionary {
+public:
+    static constexpr int NOT_FOUND = -1;
+
+    explicit TermDictionary(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : terms_(resource)
+        , slots_(16, resource) {
+    }
+
+    static uint64_t Hash(std::string_view word) {
+        uint64_t hash = 14695981039346656037ull;
+        for (const char c : word) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    int Find(std::string_view word) const {
+        return Find(word, Hash(word));
+    }
+
+    int Find(std::string_view word, uint64_t hash) const;
+    int FindOrAdd(std::string_view word);
+
+    std::string_view GetTerm(int term_id) const {
+        return terms_[term_id];
+    }
+
+    size_t GetTermCount() const {
+        return terms_.size();
+    }
+
+private:
+    struct Slot {
+        uint64_t hash = 0;
+        int term_id = NOT_FOUND;
+    };
+
+    size_t FindSlot(std::string_view word, uint64_t hash) const;
+    void Grow();
+
+    std::pmr::deque<std::pmr::string> terms_;
+    std::pmr::vector<Slot> slots_;
+};
+
+// Immutable radix trie over the terms of a TermDictionary, rebuilt from scratch
+// when the index is compacted. Every node covers a contiguous run of the terms in
+// sorted order, so the terms starting with a prefix are found by one descent and
+// enumerated without looking at any other term.
+class TermTrie {
+public:
+    explicit TermTrie(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : nodes_(resource)
+        , labels_(resource)
+        , term_ids_(resource) {
+    }
+
+    // Term id i is terms[i]. Only reads the views, so it can run off the thread that
+    // keeps adding to the dictionary they point into.
+    void Build(const std::vector<std::string_view>& terms);
+
+    // Calls func(term_id) for every term starting with `prefix`, in lexicographic order.
+    template <typename Func>
+    void ForEachWithPrefix(std::string_view prefix, Func func) const;
+
+    size_t GetTermCount() const {
+        return term_ids_.size();
+    }
+
+private:
+    // The children of a node are stored next to each other, ordered by the first byte
+    // of their labels. term_ids_[term_begin, term_end) are the terms below the node.
+    struct Node {
+        uint32_t label_begin = 0;
+        uint32_t label_size = 0;
+        uint32_t first_child = 0;
+        uint32_t child_count = 0;
+        uint32_t term_begin = 0;
+        uint32_t term_end = 0;
+    };
+
+    // The node whose run holds exactly the terms starting with `prefix`, or nullptr.
+    const Node* Descend(std::string_view prefix) const;
+
+    std::pmr::vector<Node> nodes_;
+    std::pmr::string labels_;
+    std::pmr::vector<int> term_ids_;
+};
+
+template <typename Func>
+void TermTrie::ForEachWithPrefix(std::string_view prefix, Func func) const {
+    if (const Node* node = Descend(prefix)) {
+        for (uint32_t i = node->term_begin; i < node->term_end; ++i) {
+            func(term_ids_[i]);
+        }
+    }
+}
+
+// Stop words compiled once at construction. A small bloom filter answers most
+// negative lookups with two bit tests; hits are confirmed in a TermDictionary.
+class StopWordSet {
+public:
+    template <typename StringContainer>
+    explicit StopWordSet(const StringContainer& stop_words, std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+    bool Contains(std::string_view word) const;
+
+private:
+    std::array<size_t, 2> FilterBits(uint64_t hash) const;
+    void AddToFilter(uint64_t hash);
+    bool MayContain(uint64_t hash) const;
+
+    TermDictionary words_;
+    std::pmr::vector<uint64_t> filter_;
+};
+
+template <typename StringContainer>
+StopWordSet::StopWordSet(const StringContainer& stop_words, std::pmr::memory_resource* resource)
+    : words_(resource)
+    , filter_(resource) {
+    size_t bits = 64;
+    while (bits < stop_words.size() * 16) {
+        bits *= 2;
+    }
+    filter_.assign(bits / 64, 0);
+    for (const auto& word : stop_words) {
+        words_.FindOrAdd(word);
+        AddToFilter(TermDictionary::Hash(word));
+    }
+}